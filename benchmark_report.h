@@ -0,0 +1,157 @@
+#ifndef BENCHMARK_REPORT_H_
+#define BENCHMARK_REPORT_H_
+
+// Machine readable results, shared by benchmark_suite and benchmarks: one
+// line per case, csv with a header or json lines, with the same columns:
+//   container, key, value, operation, size - what was measured;
+//   items_per_op - elements, touched by one operation;
+//   ops, ns_per_op, items_per_sec - throughput;
+//   p50_ns, p90_ns, p99_ns, max_ns - latency percentiles over samples, every
+//                  sample is the average of a timed batch of operations;
+//   peak_rss_kb - maximum resident set size of the process.
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+struct measurement {
+  std::size_t ops = 0;
+  double total_ns = 0;
+  std::vector<double> samples;
+};
+
+struct case_id {
+  std::string container;
+  std::string key;
+  std::string value;
+  std::string operation;
+  std::size_t size;
+  std::size_t items_per_op;
+
+  std::string name() const {
+    return container + '/' + key + '/' + value + '/' + operation;
+  }
+};
+
+inline double percentile(std::vector<double>& samples, double p) {
+  auto idx = std::min(
+      static_cast<std::size_t>(p * static_cast<double>(samples.size())),
+      samples.size() - 1);
+  std::nth_element(samples.begin(), samples.begin() + idx, samples.end());
+  return samples[idx];
+}
+
+inline long peak_rss_kb() {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+inline bool known_format(const std::string& format) {
+  return format == "csv" || format == "json";
+}
+
+constexpr const char* kColumns[] = {
+    "container",     "key",    "value",  "operation", "size",
+    "items_per_op",  "ops",    "ns_per_op",
+    "items_per_sec", "p50_ns", "p90_ns", "p99_ns",    "max_ns",
+    "peak_rss_kb"};
+
+constexpr std::size_t kColumnsCount = sizeof(kColumns) / sizeof(kColumns[0]);
+
+// container and operation names, like "flat_map<int, int>", have commas
+inline std::string csv_field(const std::string& field) {
+  if (field.find_first_of(",\"\n") == std::string::npos)
+    return field;
+  std::string res = "\"";
+  for (char c : field) {
+    if (c == '"')
+      res += '"';
+    res += c;
+  }
+  return res + '"';
+}
+
+inline std::string json_string(const std::string& field) {
+  std::string res = "\"";
+  for (char c : field) {
+    if (c == '"' || c == '\\')
+      res += '\\';
+    res += c;
+  }
+  return res + '"';
+}
+
+inline void print_header(const std::string& format) {
+  if (format != "csv")
+    return;
+  const char* separator = "";
+  for (const char* column : kColumns) {
+    std::cout << separator << column;
+    separator = ",";
+  }
+  std::cout << std::endl;
+}
+
+inline void print_result(const std::string& format,
+                         const case_id& id,
+                         measurement m) {
+  double ns_per_op = m.total_ns / static_cast<double>(m.ops);
+  double items_per_sec =
+      1e9 / ns_per_op * static_cast<double>(id.items_per_op);
+  std::ostringstream values[kColumnsCount];
+  values[0] << id.container;
+  values[1] << id.key;
+  values[2] << id.value;
+  values[3] << id.operation;
+  values[4] << id.size;
+  values[5] << id.items_per_op;
+  values[6] << m.ops;
+  values[7] << ns_per_op;
+  values[8] << items_per_sec;
+  values[9] << percentile(m.samples, 0.5);
+  values[10] << percentile(m.samples, 0.9);
+  values[11] << percentile(m.samples, 0.99);
+  values[12] << *std::max_element(m.samples.begin(), m.samples.end());
+  values[13] << peak_rss_kb();
+
+  // the first 4 columns are names, the rest are numbers
+  std::string line;
+  if (format == "json") {
+    line = "{";
+    for (std::size_t i = 0; i < kColumnsCount; ++i) {
+      if (i)
+        line += ", ";
+      line += std::string("\"") + kColumns[i] + "\": " +
+              (i < 4 ? json_string(values[i].str()) : values[i].str());
+    }
+    line += "}";
+  } else {
+    for (std::size_t i = 0; i < kColumnsCount; ++i) {
+      if (i)
+        line += ',';
+      line += i < 4 ? csv_field(values[i].str()) : values[i].str();
+    }
+  }
+  std::cout << line << std::endl;
+}
+
+inline bool parse_flag(const char* arg, const char* name, std::string* value) {
+  std::size_t len = std::strlen(name);
+  if (std::strncmp(arg, name, len) != 0 || arg[len] != '=')
+    return false;
+  *value = arg + len + 1;
+  return true;
+}
+
+}  // namespace bench
+
+#endif  // BENCHMARK_REPORT_H_
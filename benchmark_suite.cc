@@ -0,0 +1,436 @@
+// Flat containers against std::map/std::set across workloads.
+//
+// cmake -S . -B build && cmake --build build --target benchmark_suite
+// build/benchmark_suite [--format=csv|json] [--min-size=N] [--max-size=N]
+//                   [--budget-ms=N] [--filter=substring]
+//
+// Every case runs in a forked child, so that peak RSS belongs to that case
+// only, prepared input and probes included. Output columns are described in
+// benchmark_report.h; items_per_op is n for construction and iteration, 1 for
+// point operations, cheap point operations are timed in batches of 16.
+//
+// Mutating operations (insert, erase) work on distinct keys, so a container
+// grows at most twice or shrinks to empty during a case.
+
+#include "benchmark_report.h"
+#include "tools/flat_map.h"
+#include "tools/flat_set.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using bench::case_id;
+using bench::measurement;
+
+struct options {
+  std::string format = "csv";
+  std::size_t min_size = 8;
+  std::size_t max_size = 10000000;
+  double budget_ns = 200e6;
+  std::string filter;
+};
+
+// 10M of these don't fit into memory of a typical ci machine
+constexpr std::size_t kLargeStructMaxSize = 1000000;
+
+// at most that many distinct probes are prepared for a case
+constexpr std::size_t kProbes = 1 << 20;
+
+constexpr std::size_t kPointBatch = 16;
+
+volatile std::size_t sink;
+
+// types-----------------------------------------------------------------------
+
+struct large_struct {
+  std::uint64_t key = 0;
+  char payload[120] = {};
+};
+
+template <typename T>
+struct make;
+
+template <>
+struct make<int> {
+  static int from(std::uint64_t x) { return static_cast<int>(x); }
+};
+
+template <>
+struct make<std::uint64_t> {
+  static std::uint64_t from(std::uint64_t x) { return x; }
+};
+
+// 24 characters, so that std::string keeps it on the heap.
+// zero padding keeps the numeric order.
+template <>
+struct make<std::string> {
+  static std::string from(std::uint64_t x) {
+    std::string digits = std::to_string(x);
+    return "key_" + std::string(20 - digits.size(), '0') + digits;
+  }
+};
+
+template <>
+struct make<large_struct> {
+  static large_struct from(std::uint64_t x) {
+    large_struct res;
+    res.key = x;
+    return res;
+  }
+};
+
+std::size_t touch(int x) {
+  return static_cast<std::size_t>(x);
+}
+std::size_t touch(std::uint64_t x) {
+  return static_cast<std::size_t>(x);
+}
+std::size_t touch(const std::string& x) {
+  return x.size();
+}
+std::size_t touch(const large_struct& x) {
+  return static_cast<std::size_t>(x.key);
+}
+
+template <typename Key>
+const Key& key_of(const Key& key) {
+  return key;
+}
+
+template <typename Key, typename T>
+const Key& key_of(const std::pair<Key, T>& element) {
+  return element.first;
+}
+
+template <typename First, typename Second>
+std::size_t touch(const std::pair<First, Second>& x) {
+  return touch(x.first) + touch(x.second);
+}
+
+// element with the key, made from x
+template <typename Key, typename T>
+struct map_element {
+  using type = std::pair<Key, T>;
+  static type from(std::uint64_t x) {
+    return type(make<Key>::from(x), make<T>::from(x));
+  }
+};
+
+template <typename Key>
+struct set_element {
+  using type = Key;
+  static type from(std::uint64_t x) { return make<Key>::from(x); }
+};
+
+// measurement-----------------------------------------------------------------
+
+// runs op(i) for i in [0, max_ops) in batches until the budget is spent.
+// prepare(i) is called before each batch and is not timed.
+template <typename Prepare, typename Op>
+measurement run_timed(std::size_t max_ops,
+                      std::size_t batch,
+                      double budget_ns,
+                      Prepare prepare,
+                      Op op) {
+  using clock = std::chrono::steady_clock;
+  measurement res;
+  while (res.ops < max_ops && (res.total_ns < budget_ns || res.ops == 0)) {
+    std::size_t n = std::min(batch, max_ops - res.ops);
+    prepare(res.ops);
+    auto start = clock::now();
+    for (std::size_t i = res.ops; i < res.ops + n; ++i)
+      op(i);
+    auto finish = clock::now();
+    double ns =
+        std::chrono::duration<double, std::nano>(finish - start).count();
+    res.total_ns += ns;
+    res.samples.push_back(ns / static_cast<double>(n));
+    res.ops += n;
+  }
+  return res;
+}
+
+struct no_prepare {
+  void operator()(std::size_t) const {}
+};
+
+// runs body in a child process, so that peak rss is measured per case.
+template <typename Body>
+void run_case(const options& opts, const case_id& id, Body body) {
+  if (!opts.filter.empty() && id.name().find(opts.filter) == std::string::npos)
+    return;
+  std::cout.flush();
+  pid_t pid = fork();
+  if (pid == 0) {
+    bench::print_result(opts.format, id, body());
+    std::cout.flush();
+    _exit(0);
+  }
+  int status = 0;
+  if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0)
+    std::cerr << "failed: " << id.name() << " " << id.size << std::endl;
+}
+
+// workloads-------------------------------------------------------------------
+
+// indexes [0, n) in random order
+std::vector<std::uint64_t> shuffled(std::size_t n, std::uint64_t seed) {
+  std::vector<std::uint64_t> res(n);
+  for (std::size_t i = 0; i < n; ++i)
+    res[i] = i;
+  std::shuffle(res.begin(), res.end(), std::mt19937_64(seed));
+  return res;
+}
+
+// container holds elements, made from even numbers [0, 2n)
+template <typename Cont, typename Element>
+Cont make_container(std::size_t n) {
+  std::vector<typename Element::type> elements;
+  elements.reserve(n);
+  for (std::size_t i = 0; i < n; ++i)
+    elements.push_back(Element::from(2 * i));
+  return Cont(elements.begin(), elements.end());
+}
+
+// elements, made from 2 * order[i] + offset, at most kProbes of them
+template <typename Element>
+std::vector<typename Element::type> make_probes(std::size_t n,
+                                                std::uint64_t offset) {
+  auto order = shuffled(n, n + offset);
+  order.resize(std::min(n, kProbes));
+  std::vector<typename Element::type> res;
+  res.reserve(order.size());
+  for (std::uint64_t x : order)
+    res.push_back(Element::from(2 * x + offset));
+  return res;
+}
+
+template <typename Cont>
+std::size_t subscript(Cont& cont,
+                      const typename Cont::key_type& key,
+                      std::true_type /*is_map*/) {
+  return touch(cont[key]);
+}
+
+template <typename Cont>
+std::size_t subscript(Cont&,
+                      const typename Cont::key_type&,
+                      std::false_type /*is_map*/) {
+  return 0;
+}
+
+template <typename Cont, typename Element, typename IsMap>
+void run_workloads(const options& opts,
+                   const std::string& container,
+                   const std::string& key,
+                   const std::string& value,
+                   std::size_t n) {
+  using element_t = typename Element::type;
+  auto id = [&](const char* operation, std::size_t items_per_op) {
+    return case_id{container, key, value, operation, n, items_per_op};
+  };
+  const double budget = opts.budget_ns;
+
+  for (bool sorted : {false, true}) {
+    run_case(opts, id(sorted ? "construct_sorted" : "construct_random", n),
+             [&] {
+               std::vector<element_t> input;
+               input.reserve(n);
+               for (std::uint64_t x : shuffled(n, n))
+                 input.push_back(Element::from(x));
+               if (sorted) {
+                 std::sort(input.begin(), input.end(),
+                           [](const element_t& lhs, const element_t& rhs) {
+                             return key_of(lhs) < key_of(rhs);
+                           });
+               }
+               return run_timed(1000, 1, budget, no_prepare(),
+                                [&](std::size_t) {
+                                  Cont cont(input.begin(), input.end());
+                                  sink = sink + cont.size();
+                                });
+             });
+  }
+
+  // offset 0 - hits, 1 - misses
+  struct lookup {
+    const char* name;
+    std::uint64_t offset;
+  };
+  for (lookup l : {lookup{"find_hit", 0}, lookup{"find_miss", 1}}) {
+    run_case(opts, id(l.name, 1), [&] {
+      auto cont = make_container<Cont, Element>(n);
+      auto probes = make_probes<Element>(n, l.offset);
+      return run_timed(probes.size() * 8, kPointBatch, budget, no_prepare(),
+                       [&](std::size_t i) {
+                         const auto& probe = key_of(probes[i % probes.size()]);
+                         sink = sink + (cont.find(probe) != cont.end());
+                       });
+    });
+  }
+
+  run_case(opts, id("lower_bound", 1), [&] {
+    auto cont = make_container<Cont, Element>(n);
+    auto hits = make_probes<Element>(n, 0);
+    auto misses = make_probes<Element>(n, 1);
+    std::vector<element_t> probes;
+    for (std::size_t i = 0; i < hits.size(); ++i) {
+      probes.push_back(hits[i]);
+      probes.push_back(misses[i]);
+    }
+    return run_timed(probes.size() * 8, kPointBatch, budget, no_prepare(),
+                     [&](std::size_t i) {
+                       const auto& probe = key_of(probes[i % probes.size()]);
+                       sink = sink + (cont.lower_bound(probe) != cont.end());
+                     });
+  });
+
+  run_case(opts, id("insert", 1), [&] {
+    auto cont = make_container<Cont, Element>(n);
+    auto probes = make_probes<Element>(n, 1);
+    return run_timed(probes.size(), 1, budget, no_prepare(),
+                     [&](std::size_t i) {
+                       sink = sink + cont.insert(probes[i]).second;
+                     });
+  });
+
+  // appending in order with end() as a hint
+  run_case(opts, id("insert_hinted", 1), [&] {
+    auto cont = make_container<Cont, Element>(n);
+    std::vector<element_t> tail;
+    for (std::size_t i = 0; i < std::min(n, kProbes); ++i)
+      tail.push_back(Element::from(2 * (n + i)));
+    return run_timed(tail.size(), 1, budget, no_prepare(),
+                     [&](std::size_t i) {
+                       cont.insert(cont.end(), tail[i]);
+                     });
+  });
+
+  // n / 2 new elements in random order into a copy of the container
+  run_case(opts, id("insert_range", std::max<std::size_t>(n / 2, 1)), [&] {
+    const auto original = make_container<Cont, Element>(n);
+    auto range = make_probes<Element>(n, 1);
+    range.resize(std::max<std::size_t>(n / 2, 1));
+    Cont cont;
+    return run_timed(1000, 1, budget,
+                     [&](std::size_t) { cont = original; },
+                     [&](std::size_t) {
+                       cont.insert(range.begin(), range.end());
+                     });
+  });
+
+  run_case(opts, id("erase", 1), [&] {
+    auto cont = make_container<Cont, Element>(n);
+    auto probes = make_probes<Element>(n, 0);
+    return run_timed(probes.size(), 1, budget, no_prepare(),
+                     [&](std::size_t i) {
+                       sink = sink + cont.erase(key_of(probes[i]));
+                     });
+  });
+
+  run_case(opts, id("iterate", n), [&] {
+    auto cont = make_container<Cont, Element>(n);
+    return run_timed(1000000, 1, budget, no_prepare(), [&](std::size_t) {
+      std::size_t sum = 0;
+      for (const auto& element : cont)
+        sum += touch(element);
+      sink = sink + sum;
+    });
+  });
+
+  if (IsMap::value) {
+    run_case(opts, id("operator[]_hit", 1), [&] {
+      auto cont = make_container<Cont, Element>(n);
+      auto probes = make_probes<Element>(n, 0);
+      return run_timed(probes.size() * 8, kPointBatch, budget, no_prepare(),
+                       [&](std::size_t i) {
+                         const auto& probe = key_of(probes[i % probes.size()]);
+                         sink = sink + subscript(cont, probe, IsMap());
+                       });
+    });
+  }
+}
+
+template <typename Key, typename T>
+void run_maps(const options& opts,
+              const std::string& key,
+              const std::string& value,
+              std::size_t max_size) {
+  using element = map_element<Key, T>;
+  for (std::size_t n = opts.min_size; n <= std::min(opts.max_size, max_size);
+       n = n * 8 > max_size && n < max_size ? max_size : n * 8) {
+    run_workloads<tools::flat_map<Key, T>, element, std::true_type>(
+        opts, "flat_map", key, value, n);
+    run_workloads<std::map<Key, T>, element, std::true_type>(opts, "std::map",
+                                                            key, value, n);
+  }
+}
+
+template <typename Key>
+void run_sets(const options& opts, const std::string& key) {
+  using element = set_element<Key>;
+  const std::size_t max_size = 10000000;
+  for (std::size_t n = opts.min_size; n <= std::min(opts.max_size, max_size);
+       n = n * 8 > max_size && n < max_size ? max_size : n * 8) {
+    run_workloads<tools::flat_set<Key>, element, std::false_type>(
+        opts, "flat_set", key, "-", n);
+    run_workloads<std::set<Key>, element, std::false_type>(opts, "std::set",
+                                                          key, "-", n);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  options opts;
+  for (int i = 1; i < argc; ++i) {
+    std::string value;
+    if (bench::parse_flag(argv[i], "--format", &value)) {
+      opts.format = value;
+    } else if (bench::parse_flag(argv[i], "--min-size", &value)) {
+      opts.min_size = std::max<std::size_t>(std::stoull(value), 1);
+    } else if (bench::parse_flag(argv[i], "--max-size", &value)) {
+      opts.max_size = std::stoull(value);
+    } else if (bench::parse_flag(argv[i], "--budget-ms", &value)) {
+      opts.budget_ns = std::stod(value) * 1e6;
+    } else if (bench::parse_flag(argv[i], "--filter", &value)) {
+      opts.filter = value;
+    } else {
+      std::cerr << "unknown argument: " << argv[i] << std::endl;
+      return 1;
+    }
+  }
+  if (!bench::known_format(opts.format)) {
+    std::cerr << "unknown format: " << opts.format << std::endl;
+    return 1;
+  }
+
+  bench::print_header(opts.format);
+  run_maps<int, int>(opts, "int", "int", 10000000);
+  run_maps<std::uint64_t, std::uint64_t>(opts, "uint64_t", "uint64_t",
+                                         10000000);
+  run_maps<std::string, std::string>(opts, "string", "string", 10000000);
+  run_maps<std::uint64_t, large_struct>(opts, "uint64_t", "large_struct",
+                                        kLargeStructMaxSize);
+  run_sets<int>(opts, "int");
+  run_sets<std::uint64_t>(opts, "uint64_t");
+  run_sets<std::string>(opts, "string");
+}
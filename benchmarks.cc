@@ -0,0 +1,844 @@
+// Microbenchmarks for flat containers.
+//
+// cmake -S . -B build && cmake --build build --target benchmarks
+// build/benchmarks [--format=csv|json]
+//
+// Results are in the format of benchmark_suite, see benchmark_report.h: the
+// benchmark is in the container and operation columns, key and value are
+// "-". Cases are not forked, so peak_rss_kb is of the run so far. Memory
+// ratios, that are not timings, go to stderr.
+
+#include "benchmark_report.h"
+#include "tools/compressed_flat_set.h"
+#include "tools/cow_vector.h"
+#include "tools/filtered_flat_set.h"
+#include "tools/flat_container_hash.h"
+#include "tools/flat_map.h"
+#include "tools/frozen_flat_container.h"
+#include "tools/normalized_key.h"
+#include "tools/parallel_algorithms.h"
+#include "tools/flat_set.h"
+#include "tools/prefixed_string.h"
+#include "tools/streamable.h"
+#include "tools/streamable_collection.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace tools {
+
+// libstdc++ std::string points into itself, so only the pointer is opted in
+template <typename T>
+struct is_trivially_relocatable<std::unique_ptr<T>> : std::true_type {};
+
+}  // namespace tools
+
+namespace {
+
+// csv or json, see benchmark_report.h
+std::string output_format = "csv";
+
+constexpr std::size_t kSamples = 64;
+
+// runs op(i) for i in [0, ops) in at most kSamples timed batches, the
+// percentiles are over batch averages
+template <typename Op>
+bench::measurement measure(std::size_t ops, Op op) {
+  using clock = std::chrono::steady_clock;
+  const std::size_t batch = std::max<std::size_t>(ops / kSamples, 1);
+  bench::measurement res;
+  while (res.ops < ops) {
+    std::size_t n = std::min(batch, ops - res.ops);
+    auto start = clock::now();
+    for (std::size_t i = res.ops; i < res.ops + n; ++i)
+      op(i);
+    auto finish = clock::now();
+    double ns =
+        std::chrono::duration<double, std::nano>(finish - start).count();
+    res.total_ns += ns;
+    res.samples.push_back(ns / static_cast<double>(n));
+    res.ops += n;
+  }
+  return res;
+}
+
+// items - elements, touched by one operation
+void report(const std::string& container,
+            const std::string& operation,
+            std::size_t size,
+            bench::measurement m,
+            std::size_t items = 1) {
+  bench::print_result(output_format,
+                      bench::case_id{container, "-", "-", operation, size,
+                                     items},
+                      std::move(m));
+}
+
+template <typename T>
+T make_value(int key);
+
+template <>
+int make_value<int>(int key) {
+  return key;
+}
+
+template <>
+std::string make_value<std::string>(int key) {
+  std::string res = std::to_string(key);
+  return std::string(10 - res.size(), '0') + res;
+}
+
+template <>
+std::unique_ptr<int> make_value<std::unique_ptr<int>>(int key) {
+  return std::unique_ptr<int>(new int(key));
+}
+
+// even keys are in the map, odd ones are inserted and erased in the middle
+template <typename Key, typename T>
+void middle_insert_erase(const std::string& name, std::size_t size) {
+  using map_t = tools::flat_map<Key, T>;
+  typename map_t::underlying_type body;
+  body.reserve(size + 1);
+  for (std::size_t i = 0; i < size; ++i) {
+    int key = static_cast<int>(i * 2);
+    body.emplace_back(make_value<Key>(key), make_value<T>(key));
+  }
+  map_t map(std::move(body));
+
+  const std::size_t ops = size >= 1000000 ? 50 : 2000;
+  const int middle = static_cast<int>(size) | 1;
+
+  std::vector<Key> keys;
+  for (std::size_t i = 0; i < ops; ++i)
+    keys.push_back(make_value<Key>(middle + static_cast<int>(i) * 2));
+
+  report(name, "insert middle", size, measure(ops, [&](std::size_t i) {
+           map.insert(std::make_pair(keys[i], make_value<T>(0)));
+         }));
+  report(name, "erase middle", size, measure(ops, [&](std::size_t i) {
+           map.erase(keys[i]);
+         }));
+}
+
+void relocation_benchmarks() {
+  for (std::size_t size : {10000u, 1000000u}) {
+    middle_insert_erase<int, int>("flat_map<int, int>", size);
+    middle_insert_erase<int, std::unique_ptr<int>>(
+        "flat_map<int, unique_ptr<int>>", size);
+    middle_insert_erase<std::string, int>("flat_map<string, int>", size);
+  }
+}
+
+// same ordering as std::less, but flat containers don't know it's three way
+struct plain_string_less {
+  bool operator()(const std::string& lhs, const std::string& rhs) const {
+    return lhs < rhs;
+  }
+};
+
+std::vector<std::string> shared_prefix_keys(std::size_t size) {
+  std::vector<std::string> res;
+  res.reserve(size);
+  for (std::size_t i = 0; i < size; ++i)
+    res.push_back(std::string(64, 'x') +
+                  make_value<std::string>(static_cast<int>(i)));
+  return res;
+}
+
+template <typename Compare>
+void shared_prefix_find(const std::string& name, std::size_t size) {
+  using map_t = tools::flat_map<std::string, int, Compare>;
+  auto keys = shared_prefix_keys(size);
+  map_t map;
+  {
+    auto guard = map.unsafe_access();
+    for (const auto& key : keys)
+      guard->emplace_back(key, 0);
+  }
+
+  const std::size_t ops = 1000000;
+  int found = 0;
+  report(name, "find hit", size, measure(ops, [&](std::size_t i) {
+           found += map.find(keys[(i * 7919) % size]) != map.end();
+         }));
+  report(name, "operator[] hit", size, measure(ops, [&](std::size_t i) {
+           map[keys[(i * 7919) % size]] += 1;
+         }));
+  if (found != static_cast<int>(ops))
+    std::cerr << "unexpected miss" << std::endl;
+}
+
+void three_way_benchmarks() {
+  for (std::size_t size : {1000u, 100000u}) {
+    shared_prefix_find<std::less<std::string>>(
+        "flat_map<string(shared prefix), int> three way", size);
+    shared_prefix_find<plain_string_less>(
+        "flat_map<string(shared prefix), int> less", size);
+  }
+}
+
+// 32 byte keys, so that std::string keeps them on the heap
+template <typename Key>
+void long_string_find(const std::string& name, std::size_t size) {
+  std::vector<Key> keys;
+  keys.reserve(size);
+  std::uint64_t state = 42;
+  for (std::size_t i = 0; i < size; ++i) {
+    std::string key;
+    while (key.size() < 32) {
+      state = state * 6364136223846793005u + 1442695040888963407u;
+      key += static_cast<char>('a' + (state >> 59));
+    }
+    keys.emplace_back(std::move(key));
+  }
+
+  tools::flat_map<Key, int> map;
+  {
+    auto guard = map.unsafe_access();
+    for (const auto& key : keys)
+      guard->emplace_back(key, 0);
+  }
+
+  const std::size_t ops = 1000000;
+  int found = 0;
+  report(name, "find hit", size, measure(ops, [&](std::size_t i) {
+           found += map.find(keys[(i * 7919) % size]) != map.end();
+         }));
+  if (found != static_cast<int>(ops))
+    std::cerr << "unexpected miss" << std::endl;
+}
+
+void prefixed_string_benchmarks() {
+  for (std::size_t size : {10000u, 1000000u}) {
+    long_string_find<std::string>("flat_map<string, int>", size);
+    long_string_find<tools::prefixed_string>("flat_map<prefixed_string, int>",
+                                             size);
+  }
+}
+
+tools::flat_map<int, int> sequential_map(std::size_t size) {
+  tools::flat_map<int, int>::underlying_type body;
+  body.reserve(size);
+  for (std::size_t i = 0; i < size; ++i)
+    body.emplace_back(static_cast<int>(i), 0);
+  tools::flat_map<int, int> res;
+  *res.unsafe_access() = std::move(body);
+  return res;
+}
+
+// every 10th element is erased, like a ttl sweep
+void sweep(std::size_t size) {
+  std::vector<int> keys;
+  for (std::size_t i = 0; i < size; i += 10)
+    keys.push_back(static_cast<int>(i));
+
+  auto map = sequential_map(size);
+  report("flat_map<int, int>", "erase_keys 10%", size,
+         measure(1, [&](std::size_t) {
+           map.erase_keys(keys.begin(), keys.end());
+         }));
+
+  map = sequential_map(size);
+  report("flat_map<int, int>", "erase_if 10%", size,
+         measure(1, [&](std::size_t) {
+           tools::erase_if(map, [](const std::pair<int, int>& element) {
+             return element.first % 10 == 0;
+           });
+         }));
+
+  if (size > 100000)
+    return;
+  map = sequential_map(size);
+  report("flat_map<int, int>", "erase(key) 10%", size,
+         measure(1, [&](std::size_t) {
+           for (int key : keys)
+             map.erase(key);
+         }));
+}
+
+void bulk_erase_benchmarks() {
+  for (std::size_t size : {100000u, 5000000u})
+    sweep(size);
+}
+
+// intersection of a small map with a big one, like a merge join
+void intersect(std::size_t size, std::size_t step) {
+  auto big = sequential_map(size);
+  tools::flat_map<int, int> small;
+  {
+    auto guard = small.unsafe_access();
+    for (std::size_t i = 0; i < size; i += step)
+      guard->emplace_back(static_cast<int>(i), 0);
+  }
+
+  std::string name = "intersect 1/" + std::to_string(step);
+  std::size_t found = 0;
+  report("flat_map<int, int>", name + " lower_bound", size,
+         measure(1, [&](std::size_t) {
+           for (const auto& element : small)
+             found += big.find(element.first) != big.end();
+         }));
+  report("flat_map<int, int>", name + " cursor", size,
+         measure(1, [&](std::size_t) {
+           auto cursor = tools::make_flat_cursor(big);
+           for (const auto& element : small)
+             found += cursor.find(element.first) != big.end();
+         }));
+  if (found != 2 * small.size())
+    std::cerr << "unexpected miss" << std::endl;
+}
+
+void galloping_benchmarks() {
+  for (std::size_t step : {2u, 64u, 4096u})
+    intersect(4000000, step);
+}
+
+// keys of the set are even, hit_percent of probes hit
+template <typename Set>
+void deny_list(const std::string& name, std::size_t size, int hit_percent) {
+  std::vector<std::string> keys;
+  for (std::size_t i = 0; i < size; ++i)
+    keys.push_back(make_value<std::string>(static_cast<int>(i * 2)));
+  Set set(keys.begin(), keys.end());
+
+  const std::size_t ops = 1000000;
+  std::vector<std::string> probes;
+  std::uint64_t state = 1;
+  for (std::size_t i = 0; i < 4096; ++i) {
+    state = state * 6364136223846793005u + 1442695040888963407u;
+    auto key = static_cast<int>((state >> 33) % size) * 2;
+    bool hit = static_cast<int>((state >> 20) % 100) < hit_percent;
+    probes.push_back(make_value<std::string>(hit ? key : key + 1));
+  }
+  set.count(probes[0]);  // builds the filter
+
+  std::size_t found = 0;
+  report(name, "count " + std::to_string(hit_percent) + "% hits", size,
+         measure(ops, [&](std::size_t i) {
+           found += set.count(probes[i % probes.size()]);
+         }));
+  if (found > ops)
+    std::cerr << "unexpected hit" << std::endl;
+}
+
+void filter_benchmarks() {
+  for (std::size_t size : {10000u, 1000000u}) {
+    for (int hit_percent : {5, 95}) {
+      deny_list<tools::flat_set<std::string>>("flat_set<string>", size,
+                                              hit_percent);
+      deny_list<tools::filtered_flat_set<std::string>>(
+          "filtered_flat_set<string>", size, hit_percent);
+    }
+  }
+}
+
+template <typename Key>
+void frozen_find(const std::string& name, std::size_t size) {
+  tools::flat_map<Key, int> map;
+  {
+    auto guard = map.unsafe_access();
+    for (std::size_t i = 0; i < size; ++i)
+      guard->emplace_back(make_value<Key>(static_cast<int>(i * 2)), 0);
+  }
+
+  tools::frozen_flat_container<tools::flat_map<Key, int>> frozen;
+  report(name, "freeze", size, measure(1, [&](std::size_t) {
+           frozen = tools::freeze(map);
+         }));
+  std::cerr << name << " perfect hash bits per key\t" << size << '\t'
+            << 8.0 * static_cast<double>(frozen.hash_memory_bytes()) /
+                   static_cast<double>(size)
+            << std::endl;
+
+  std::vector<Key> probes;
+  for (std::size_t i = 0; i < 4096; ++i)
+    probes.push_back(make_value<Key>(static_cast<int>((i * 7919) % size) * 2 +
+                                     static_cast<int>(i % 2)));
+  const std::size_t ops = 1000000;
+  std::size_t found = 0;
+  report(name, "find 50% hits", size, measure(ops, [&](std::size_t i) {
+           found += map.find(probes[i % probes.size()]) != map.end();
+         }));
+  report(name, "frozen find 50% hits", size,
+         measure(ops, [&](std::size_t i) {
+           found += frozen.find(probes[i % probes.size()]) != frozen.end();
+         }));
+  if (found != ops)
+    std::cerr << "unexpected miss" << std::endl;
+}
+
+void frozen_benchmarks() {
+  for (std::size_t size : {10000u, 1000000u}) {
+    frozen_find<int>("flat_map<int, int>", size);
+    frozen_find<std::string>("flat_map<string, int>", size);
+  }
+}
+
+// sorted ids with random gaps of 1..average_gap * 2
+void compressed_find(std::size_t size, std::uint64_t average_gap) {
+  std::vector<std::uint64_t> ids;
+  ids.reserve(size);
+  std::uint64_t state = 5;
+  std::uint64_t id = 1u << 20;
+  for (std::size_t i = 0; i < size; ++i) {
+    state = state * 6364136223846793005u + 1442695040888963407u;
+    id += (state >> 33) % (average_gap * 2) + 1;
+    ids.push_back(id);
+  }
+  tools::flat_set<std::uint64_t> set;
+  *set.unsafe_access() = ids;
+  tools::compressed_flat_set<> compressed(set);
+
+  std::string name = "gap " + std::to_string(average_gap);
+  std::cerr << "compressed_flat_set<uint64_t> " << name << " memory x"
+            << '\t' << size << '\t'
+            << static_cast<double>(size * sizeof(std::uint64_t)) /
+                   static_cast<double>(compressed.memory_bytes())
+            << std::endl;
+
+  std::vector<std::uint64_t> probes;
+  for (std::size_t i = 0; i < 4096; ++i)
+    probes.push_back(ids[(i * 7919) % size] + i % 2);
+  const std::size_t ops = 1000000;
+  std::size_t found = 0;
+  report("flat_set<uint64_t>", name + " lower_bound", size,
+         measure(ops, [&](std::size_t i) {
+           found += *set.lower_bound(probes[i % probes.size()]) & 1;
+         }));
+  report("compressed_flat_set<uint64_t>", name + " lower_bound", size,
+         measure(ops, [&](std::size_t i) {
+           found += *compressed.lower_bound(probes[i % probes.size()]) & 1;
+         }));
+  std::uint64_t sum = 0;
+  report("flat_set<uint64_t>", name + " iterate", size,
+         measure(1, [&](std::size_t) {
+           for (std::uint64_t key : set)
+             sum += key;
+         }));
+  report("compressed_flat_set<uint64_t>", name + " iterate", size,
+         measure(1, [&](std::size_t) {
+           for (std::uint64_t key : compressed)
+             sum += key;
+         }));
+  if (sum % 2 != 0 || found > ops * 2)
+    std::cerr << "unexpected sum" << std::endl;
+}
+
+void compressed_benchmarks() {
+  for (std::uint64_t gap : {1u, 8u, 256u})
+    compressed_find(10000000, gap);
+}
+
+void parallel_benchmarks() {
+  const std::size_t size = 10000000;
+  auto map = sequential_map(size);
+  std::vector<int> probes;
+  for (std::size_t i = 0; i < size; ++i)
+    probes.push_back(static_cast<int>((i * 7919) % (size * 2)));
+
+  for (std::size_t threads : {1u, 2u, 4u, 8u, 16u, 32u}) {
+    tools::thread_pool pool(threads);
+    std::string name = std::to_string(threads) + " threads";
+    std::size_t found = 0;
+    report("flat_map<int, int>", "find_many 10M probes " + name, size,
+           measure(1, [&](std::size_t) {
+             for (auto it : tools::find_many(map, probes.begin(), probes.end(),
+                                             pool))
+               found += it != map.end();
+           }));
+    long long sum = 0;
+    report("flat_map<int, int>", "parallel_reduce " + name, size,
+           measure(1, [&](std::size_t) {
+             sum += tools::parallel_reduce(
+                 tools::key_range(map), 0ll,
+                 [](long long res, const std::pair<int, int>& element) {
+                   return res + element.first;
+                 },
+                 [](long long lhs, long long rhs) { return lhs + rhs; }, pool);
+           }));
+    if (found == 0 || sum <= 0)
+      std::cerr << "unexpected result" << std::endl;
+  }
+}
+
+using composite_key = std::tuple<std::int64_t, std::string, std::uint32_t>;
+
+// few distinct first fields, so comparisons go into the strings
+std::vector<composite_key> composite_keys(std::size_t size) {
+  std::vector<composite_key> res;
+  for (std::size_t i = 0; i < size; ++i) {
+    int key = static_cast<int>(i);
+    res.emplace_back(key % 4 - 2, make_value<std::string>(key / 16), key % 16);
+  }
+  return res;
+}
+
+template <typename Key, typename Probes>
+void composite_find(const std::string& name,
+                    const std::string& operation,
+                    const std::vector<composite_key>& keys,
+                    const Probes& probes) {
+  tools::flat_map<Key, int> map;
+  {
+    auto guard = map.unsafe_access();
+    for (const auto& key : keys)
+      guard->emplace_back(key, 0);
+  }
+  const std::size_t ops = 1000000;
+  std::size_t found = 0;
+  report(name, operation, keys.size(), measure(ops, [&](std::size_t i) {
+           found += map.count(probes[(i * 7919) % probes.size()]);
+         }));
+  if (found != ops)
+    std::cerr << "unexpected miss" << std::endl;
+}
+
+void normalized_key_benchmarks() {
+  for (std::size_t size : {1000u, 1000000u}) {
+    auto keys = composite_keys(size);
+    std::vector<tools::normalized_key<composite_key>> normalized(keys.begin(),
+                                                                 keys.end());
+    composite_find<composite_key>("flat_map<tuple<int64, string, uint32>>",
+                                  "count", keys, keys);
+    composite_find<tools::normalized_key<composite_key>>(
+        "flat_map<normalized_key<tuple>>", "count normalized probes", keys,
+        normalized);
+    composite_find<tools::normalized_key<composite_key>>(
+        "flat_map<normalized_key<tuple>>", "count tuple probes", keys, keys);
+  }
+}
+
+// counts of keys from batches, half of them are new to the map
+void aggregate(std::size_t size, std::size_t batch_size) {
+  std::vector<std::pair<int, int>> batch;
+  auto fill_batch = [&](std::size_t round) {
+    batch.clear();
+    for (std::size_t i = 0; i < batch_size; ++i) {
+      auto key = (round * batch_size + i) * 7919 % (size * 2);
+      batch.emplace_back(static_cast<int>(key), 1);
+    }
+  };
+  const std::size_t rounds = size / batch_size;
+  const std::string name = "aggregate batch " + std::to_string(batch_size);
+
+  tools::flat_map<int, int> map;
+  report("flat_map<int, int>", name + " operator[] +=", size,
+         measure(rounds,
+                 [&](std::size_t i) {
+                   fill_batch(i);
+                   for (const auto& element : batch)
+                     map[element.first] += element.second;
+                 }),
+         batch_size);
+
+  tools::flat_map<int, int> batched;
+  report("flat_map<int, int>", name + " upsert_many", size,
+         measure(rounds,
+                 [&](std::size_t i) {
+                   fill_batch(i);
+                   batched.upsert_many(batch.begin(), batch.end(),
+                                       std::plus<int>());
+                 }),
+         batch_size);
+
+  if (map != batched)
+    std::cerr << "unexpected result" << std::endl;
+}
+
+void upsert_benchmarks() {
+  for (std::size_t batch_size : {100u, 10000u})
+    aggregate(100000, batch_size);
+}
+
+// a config map, passed by value through pipeline stages, that read it
+template <typename Map>
+void pass_by_value(const std::string& name, std::size_t size) {
+  typename Map::underlying_type body;
+  for (std::size_t i = 0; i < size; ++i) {
+    int key = static_cast<int>(i);
+    body.emplace_back(make_value<std::string>(key), key);
+  }
+  const Map config(tools::sorted_unique, std::move(body));
+  const std::string probe = make_value<std::string>(static_cast<int>(size / 2));
+
+  long long sum = 0;
+  auto stage = [&](Map copy) {
+    const Map& read = copy;
+    sum += read.at(probe);
+    return copy;
+  };
+  report(name, "copy and read", size, measure(200, [&](std::size_t) {
+           Map copy = stage(stage(config));
+           sum += copy == config;
+         }));
+  if (sum == 0)
+    std::cerr << "unexpected result" << std::endl;
+}
+
+void cow_benchmarks() {
+  for (std::size_t size : {100u, 100000u}) {
+    pass_by_value<tools::flat_map<std::string, int>>(
+        "flat_map<string, int>", size);
+    pass_by_value<tools::cow_flat_map<std::string, int>>(
+        "cow_flat_map<string, int>", size);
+  }
+}
+
+// feature combinations: flat_set<uint32_t> of 64 elements as hash keys
+void hash_benchmarks() {
+  using set_t = tools::flat_set<std::uint32_t>;
+  const std::size_t size = 64;
+  const std::size_t count = 1024;
+  std::vector<set_t> sets;
+  for (std::size_t i = 0; i < count; ++i) {
+    set_t set;
+    {
+      auto guard = set.unsafe_access();
+      for (std::size_t j = 0; j < size; ++j)
+        guard->push_back(static_cast<std::uint32_t>(j * 5 + (j == 60 ? i : 0)));
+    }
+    sets.push_back(std::move(set));
+  }
+  std::vector<tools::hashed_flat_set<std::uint32_t>> hashed;
+  for (const auto& set : sets)
+    hashed.emplace_back(set);
+
+  const std::size_t ops = 2000000;
+  std::size_t sink = 0;
+  report("flat_set<uint32_t>", "hash by element", size,
+         measure(ops, [&](std::size_t i) {
+           sink += tools::internal::hash_body(sets[i % count],
+                                              std::false_type{});
+         }));
+  report("flat_set<uint32_t>", "hash bytes", size,
+         measure(ops, [&](std::size_t i) {
+           sink += std::hash<set_t>()(sets[i % count]);
+         }));
+  report("hashed_flat_set<uint32_t>", "hash cached", size,
+         measure(ops, [&](std::size_t i) {
+           sink += std::hash<tools::hashed_flat_set<std::uint32_t>>()(
+               hashed[i % count]);
+         }));
+  report("flat_set<uint32_t>", "== by element", size,
+         measure(ops, [&](std::size_t i) {
+           const auto& lhs = sets[i % count];
+           const auto& rhs = sets[(i + 1) % count];
+           sink += std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(),
+                              [](std::uint32_t a, std::uint32_t b) {
+                                return a == b;
+                              });
+         }));
+  report("flat_set<uint32_t>", "== memcmp", size,
+         measure(ops, [&](std::size_t i) {
+           sink += sets[i % count] == sets[(i + 1) % count];
+         }));
+  report("flat_set<uint32_t>", "< by element", size,
+         measure(ops, [&](std::size_t i) {
+           const auto& lhs = sets[i % count];
+           const auto& rhs = sets[(i + 1) % count];
+           sink += std::lexicographical_compare(lhs.begin(), lhs.end(),
+                                                rhs.begin(), rhs.end());
+         }));
+  report("flat_set<uint32_t>", "< memcmp blocks", size,
+         measure(ops, [&](std::size_t i) {
+           sink += sets[i % count] < sets[(i + 1) % count];
+         }));
+  if (sink == 0)
+    std::cerr << "unexpected result" << std::endl;
+}
+
+// streamable as it was: a virtual base class and one allocation per value
+class heap_streamable {
+ public:
+  template <typename T>
+  heap_streamable(T that)  // NOLINT
+      : body_{new obj_t<T>(std::move(that))} {}
+
+  heap_streamable(const heap_streamable& that)
+      : body_(that.body_->clone()) {}
+  heap_streamable(heap_streamable&&) = default;
+
+  friend std::ostream& operator<<(std::ostream& out,
+                                  const heap_streamable& that) {
+    return that.body_->stream(out);
+  }
+
+ private:
+  struct concept_t {
+    virtual std::ostream& stream(std::ostream& stream) const = 0;
+    virtual std::unique_ptr<concept_t> clone() const = 0;
+    virtual ~concept_t() {}
+  };
+
+  template <typename T>
+  struct obj_t : concept_t {
+    explicit obj_t(T that) : body_{std::move(that)} {}
+
+    std::ostream& stream(std::ostream& stream) const final {
+      return stream << body_;
+    }
+
+    std::unique_ptr<concept_t> clone() const final {
+      return std::unique_ptr<concept_t>{new obj_t{body_}};
+    }
+
+    T body_;
+  };
+
+  std::unique_ptr<concept_t> body_;
+};
+
+// log record fields: every other one is an int, the rest short strings
+template <typename Streamable>
+void streamable_ops(const std::string& name, std::size_t size) {
+  std::vector<std::string> strings;
+  for (std::size_t i = 0; i < size; ++i)
+    strings.push_back(make_value<std::string>(static_cast<int>(i)));
+
+  std::vector<Streamable> fields;
+  const std::size_t rounds = 20;
+  report(name, "construct", size, measure(rounds, [&](std::size_t) {
+           fields.clear();
+           fields.reserve(size);
+           for (std::size_t i = 0; i < size; ++i) {
+             if (i % 2)
+               fields.emplace_back(strings[i]);
+             else
+               fields.emplace_back(static_cast<int>(i));
+           }
+         }),
+         size);
+
+  std::size_t copied = 0;
+  report(name, "copy", size, measure(rounds, [&](std::size_t) {
+           std::vector<Streamable> copy = fields;
+           copied += copy.size();
+         }),
+         size);
+
+  std::ostringstream out;
+  report(name, "stream", size, measure(rounds, [&](std::size_t) {
+           out.str(std::string());
+           for (const auto& field : fields)
+             out << field;
+         }),
+         size);
+
+  if (copied != rounds * size || out.str().empty())
+    std::cerr << "unexpected result" << std::endl;
+}
+
+void streamable_benchmarks() {
+  for (std::size_t size : {1000u, 100000u}) {
+    streamable_ops<heap_streamable>("heap_streamable", size);
+    streamable_ops<tools::streamable>("streamable", size);
+  }
+}
+
+// f(value) for a pseudo random mix of ints, doubles and short strings
+template <typename F>
+void mixed_records(std::size_t size, F f) {
+  for (std::size_t i = 0; i < size; ++i) {
+    switch ((i * 7919) % 3) {
+      case 0:
+        f(static_cast<int>(i));
+        break;
+      case 1:
+        f(static_cast<double>(i) / 4);
+        break;
+      default:
+        f(make_value<std::string>(static_cast<int>(i)));
+    }
+  }
+}
+
+template <typename Streamable>
+void stream_vector(const std::string& name, std::size_t size) {
+  std::vector<Streamable> records;
+  mixed_records(size, [&](auto value) { records.emplace_back(value); });
+  std::ostringstream out;
+  report(name, "stream", size, measure(10, [&](std::size_t) {
+           out.str(std::string());
+           for (const auto& record : records)
+             out << record;
+         }),
+         size);
+  std::size_t copied = 0;
+  report(name, "copy", size, measure(10, [&](std::size_t) {
+           auto copy = records;
+           copied += copy.size();
+         }),
+         size);
+  if (copied != 10 * size || out.str().empty())
+    std::cerr << "unexpected result" << std::endl;
+}
+
+void stream_collection(std::size_t size) {
+  tools::streamable_collection records;
+  mixed_records(size, [&](auto value) { records.insert(value); });
+  std::ostringstream out;
+  report("streamable_collection", "stream", size,
+         measure(10, [&](std::size_t) {
+           out.str(std::string());
+           out << records;
+         }),
+         size);
+  std::size_t copied = 0;
+  report("streamable_collection", "copy", size, measure(10, [&](std::size_t) {
+           auto copy = records;
+           copied += copy.size();
+         }),
+         size);
+  if (copied != 10 * size || out.str().empty())
+    std::cerr << "unexpected result" << std::endl;
+}
+
+void streamable_collection_benchmarks() {
+  for (std::size_t size : {1000u, 1000000u}) {
+    stream_vector<heap_streamable>("vector<heap_streamable>", size);
+    stream_vector<tools::streamable>("vector<streamable>", size);
+    stream_collection(size);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; ++i) {
+    if (!bench::parse_flag(argv[i], "--format", &output_format)) {
+      std::cerr << "unknown argument: " << argv[i] << std::endl;
+      return 1;
+    }
+  }
+  if (!bench::known_format(output_format)) {
+    std::cerr << "unknown format: " << output_format << std::endl;
+    return 1;
+  }
+
+  bench::print_header(output_format);
+  relocation_benchmarks();
+  three_way_benchmarks();
+  prefixed_string_benchmarks();
+  bulk_erase_benchmarks();
+  galloping_benchmarks();
+  filter_benchmarks();
+  frozen_benchmarks();
+  compressed_benchmarks();
+  parallel_benchmarks();
+  normalized_key_benchmarks();
+  upsert_benchmarks();
+  hash_benchmarks();
+  cow_benchmarks();
+  streamable_benchmarks();
+  streamable_collection_benchmarks();
+}
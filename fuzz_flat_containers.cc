@@ -0,0 +1,503 @@
+// Differential fuzzing of flat containers against std::map/std::set.
+//
+// libFuzzer:
+//   clang++ -std=c++14 -g -O1 -fsanitize=fuzzer,address,undefined
+//       -DFLAT_FUZZ_LIBFUZZER -I. fuzz_flat_containers.cc -o fuzz && ./fuzz
+// standalone, random inputs or replay of saved ones:
+//   g++ -std=c++14 -g -O1 -fsanitize=address,undefined -I.
+//       fuzz_flat_containers.cc -o fuzz_flat_containers
+//   ./fuzz_flat_containers [--runs=N] [--seed=N] [input files...]
+//
+// Every input is a sequence of operations, applied to a flat container and
+// to it's std counterpart. After each operation contents and returned
+// positions must match, and the counting_stats of the flat container must
+// stay within the complexity of the operation: O(log n) comparisons per
+// lookup, O(n) moves per insert/erase and exactly one sort per unsafe_access.
+// Any mismatch prints the operation and aborts.
+
+#include "tools/flat_map.h"
+#include "tools/flat_set.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+class input_reader {
+ public:
+  input_reader(const std::uint8_t* data, std::size_t size)
+      : data_(data), size_(size) {}
+
+  bool empty() const { return pos_ == size_; }
+
+  // zero after the end of input, so that truncated inputs stay valid
+  std::uint8_t byte() { return pos_ < size_ ? data_[pos_++] : 0; }
+
+ private:
+  const std::uint8_t* data_;
+  std::size_t size_;
+  std::size_t pos_ = 0;
+};
+
+[[noreturn]] void fail(std::size_t op_index, const char* op, const char* what) {
+  std::cerr << "operation " << op_index << " (" << op << "): " << what
+            << std::endl;
+  std::abort();
+}
+
+std::size_t bit_width(std::size_t n) {
+  std::size_t res = 0;
+  for (; n; n >>= 1)
+    ++res;
+  return res;
+}
+
+// keys and values -------------------------------------------------------------
+
+std::string make_key(std::string*, std::uint8_t byte) {
+  // some keys share a long prefix, so that comparisons are not trivial
+  return byte % 2 ? "shared prefix " + std::to_string(byte)
+                  : std::to_string(byte);
+}
+
+int make_key(int*, std::uint8_t byte) {
+  return byte;
+}
+
+template <typename Key, typename T>
+const Key& key_of(const std::pair<Key, T>& value) {
+  return value.first;
+}
+
+template <typename Key>
+const Key& key_of(const Key& value) {
+  return value;
+}
+
+// std::map has const keys
+struct values_equal {
+  template <typename Lhs, typename Rhs>
+  bool operator()(const Lhs& lhs, const Rhs& rhs) const {
+    return lhs == rhs;
+  }
+
+  template <typename L1, typename L2, typename R1, typename R2>
+  bool operator()(const std::pair<L1, L2>& lhs,
+                  const std::pair<R1, R2>& rhs) const {
+    return lhs.first == rhs.first && lhs.second == rhs.second;
+  }
+};
+
+// duplicates in one range insert are indistinguishable: order of equal
+// elements after the unstable sort is unspecified.
+template <typename Key, typename T>
+void make_value(std::pair<Key, T>* res, const Key& key, std::uint8_t mapped) {
+  *res = std::make_pair(key, static_cast<T>(mapped));
+}
+
+template <typename Key>
+void make_value(Key* res, const Key& key, std::uint8_t) {
+  *res = key;
+}
+
+// harness ---------------------------------------------------------------------
+
+template <typename FlatCont, typename StdCont>
+class differential_test {
+  using key_type = typename FlatCont::key_type;
+  using value_type = typename FlatCont::value_type;
+  using is_map =
+      std::integral_constant<bool,
+                             !std::is_same<key_type, value_type>::value>;
+
+ public:
+  explicit differential_test(input_reader* input) : input_(*input) {}
+
+  void run() {
+    while (!input_.empty()) {
+      ++op_index_;
+      flat_.stats().reset();
+      size_before_ = flat_.size();
+      step();
+      check_equal();
+    }
+  }
+
+ private:
+  key_type key() {
+    return make_key(static_cast<key_type*>(nullptr), input_.byte());
+  }
+
+  value_type value() {
+    value_type res;
+    auto k = key();
+    make_value(&res, k, input_.byte());
+    return res;
+  }
+
+  void check(bool condition, const char* what) {
+    if (!condition)
+      fail(op_index_, op_, what);
+  }
+
+  template <typename FlatIt, typename StdIt>
+  void check_position(FlatIt flat_it, StdIt std_it) {
+    check(std::distance(flat_.cbegin(), typename FlatCont::const_iterator(
+                                            flat_it)) ==
+              std::distance(std_.cbegin(),
+                            typename StdCont::const_iterator(std_it)),
+          "positions differ");
+  }
+
+  void check_equal() {
+    check(flat_.size() == std_.size(), "sizes differ");
+    check(std::equal(flat_.begin(), flat_.end(), std_.begin(), values_equal()),
+          "contents differ");
+  }
+
+  // costs -------------------------------------------------------------------
+
+  void check_lookups(std::size_t lookups) {
+    auto stats = flat_.stats().snapshot();
+    check(stats.lookups == lookups, "unexpected number of lookups");
+    // equal_range does two binary searches, bool comparisons need two more
+    // calls to check equality
+    auto limit = 2 * (bit_width(std::max(size_before_, flat_.size())) + 1);
+    check(stats.max_comparisons <= limit, "too many comparisons");
+  }
+
+  void check_moves() {
+    auto stats = flat_.stats().snapshot();
+    check(stats.elements_moved <= std::max(size_before_, flat_.size()),
+          "too many elements moved");
+    check(stats.sorts == 0, "unexpected sort");
+  }
+
+  // operations ----------------------------------------------------------------
+
+  void step() {
+    switch (input_.byte() % 16) {
+      case 0: return insert();
+      case 1: return emplace();
+      case 2: return map_only(is_map{});
+      case 3: return erase_key();
+      case 4: return erase_position();
+      case 5: return erase_range();
+      case 6: return find();
+      case 7: return bounds();
+      case 8: return insert_range();
+      case 9: return unsafe_region();
+      case 10: return erase_keys();
+      case 11: return erase_if();
+      case 12: return copy_and_swap();
+      case 13: return gallop();
+      default: return insert();
+    }
+  }
+
+  void insert() {
+    op_ = "insert";
+    auto v = value();
+    auto flat_res = flat_.insert(v);
+    auto std_res = std_.insert(v);
+    check(flat_res.second == std_res.second, "inserted differs");
+    check_position(flat_res.first, std_res.first);
+    check_lookups(1);
+    check_moves();
+  }
+
+  void emplace() {
+    op_ = "emplace";
+    auto v = value();
+    auto flat_res = flat_.emplace(v);
+    auto std_res = std_.emplace(v);
+    check(flat_res.second == std_res.second, "inserted differs");
+    check_position(flat_res.first, std_res.first);
+    check_lookups(1);
+    check_moves();
+  }
+
+  void map_only(std::false_type /*is_map*/) { emplace(); }
+
+  void map_only(std::true_type /*is_map*/) {
+    auto k = key();
+    int mapped = input_.byte();
+    switch (input_.byte() % 3) {
+      case 0: {
+        op_ = "try_emplace";
+        auto flat_res = flat_.try_emplace(k, mapped);
+        auto std_res = std_.emplace(k, mapped);
+        check(flat_res.second == std_res.second, "inserted differs");
+        check_position(flat_res.first, std_res.first);
+        break;
+      }
+      case 1: {
+        op_ = "insert_or_assign";
+        auto flat_res = flat_.insert_or_assign(k, mapped);
+        auto std_res = std_.emplace(k, mapped);
+        if (!std_res.second)
+          std_res.first->second = mapped;
+        check(flat_res.second == std_res.second, "inserted differs");
+        check_position(flat_res.first, std_res.first);
+        break;
+      }
+      default:
+        op_ = "operator[]";
+        flat_[k] += mapped;
+        std_[k] += mapped;
+    }
+    check_lookups(1);
+    check_moves();
+  }
+
+  void erase_key() {
+    op_ = "erase(key)";
+    auto k = key();
+    check(flat_.erase(k) == std_.erase(k), "erased count differs");
+    check_lookups(1);
+    check_moves();
+  }
+
+  void erase_position() {
+    op_ = "erase(position)";
+    if (std_.empty())
+      return;
+    auto offset = input_.byte() % std_.size();
+    auto flat_res = flat_.erase(std::next(flat_.cbegin(), offset));
+    auto std_res = std_.erase(std::next(std_.cbegin(), offset));
+    check_position(flat_res, std_res);
+    check_lookups(0);
+    check_moves();
+  }
+
+  void erase_range() {
+    op_ = "erase(first, last)";
+    auto lhs = key();
+    auto rhs = key();
+    if (std_.key_comp()(rhs, lhs))
+      std::swap(lhs, rhs);
+    flat_.erase(flat_.lower_bound(lhs), flat_.upper_bound(rhs));
+    std_.erase(std_.lower_bound(lhs), std_.upper_bound(rhs));
+    check_lookups(2);
+    check_moves();
+  }
+
+  void find() {
+    op_ = "find";
+    auto k = key();
+    const FlatCont& flat = flat_;
+    check_position(flat.find(k), std_.find(k));
+    check(flat.count(k) == std_.count(k), "count differs");
+    check_lookups(2);
+  }
+
+  void bounds() {
+    op_ = "lower_bound/upper_bound/equal_range";
+    auto k = key();
+    check_position(flat_.lower_bound(k), std_.lower_bound(k));
+    check_position(flat_.upper_bound(k), std_.upper_bound(k));
+    auto flat_range = flat_.equal_range(k);
+    auto std_range = std_.equal_range(k);
+    check_position(flat_range.first, std_range.first);
+    check_position(flat_range.second, std_range.second);
+    check_lookups(3);
+  }
+
+  void gallop() {
+    op_ = "lower_bound_from/find_from";
+    auto k = key();
+    auto std_pos = std_.lower_bound(k);
+    auto limit = std::distance(std_.begin(), std_pos);
+    auto from = flat_.cbegin() + (limit ? input_.byte() % (limit + 1) : 0);
+    check_position(flat_.lower_bound_from(from, k), std_pos);
+    check_position(flat_.find_from(from, k), std_.find(k));
+    // galloping costs at most twice as much as a binary search
+    check_lookups(2);
+  }
+
+  void insert_range() {
+    op_ = "insert(first, last)";
+    std::vector<value_type> range;
+    for (std::size_t n = input_.byte() % 32; n; --n)
+      range.push_back(value());
+    // equal elements of a range must be equal as values as well
+    std::map<key_type, value_type, typename StdCont::key_compare> seen(
+        std_.key_comp());
+    for (auto& v : range)
+      v = seen.emplace(key_of(v), v).first->second;
+
+    flat_.insert(range.begin(), range.end());
+    std_.insert(range.begin(), range.end());
+    auto stats = flat_.stats().snapshot();
+    check(stats.elements_moved <= size_before_ + range.size(),
+          "too many elements moved");
+    check(stats.sorts == 1 && stats.sorted_elements == range.size(),
+          "range is not sorted once");
+  }
+
+  void unsafe_region() {
+    op_ = "unsafe_access";
+    {
+      auto guard = flat_.unsafe_access();
+      for (std::size_t n = input_.byte() % 8; n; --n) {
+        auto v = value();
+        switch (input_.byte() % 3) {
+          case 0:
+            // existing keys would make the surviving duplicate unspecified
+            if (std_.insert(v).second)
+              guard->push_back(v);
+            break;
+          case 1:
+            if (!guard->empty()) {
+              std_.erase(key_of(guard->back()));
+              guard->pop_back();
+            }
+            break;
+          default:
+            std::reverse(guard->begin(), guard->end());
+        }
+      }
+    }
+    auto stats = flat_.stats().snapshot();
+    check(stats.sorts == 1 && stats.sorted_elements == flat_.size(),
+          "body is not sorted once");
+  }
+
+  void erase_keys() {
+    op_ = "erase_keys";
+    std::vector<key_type> keys;
+    for (std::size_t n = input_.byte() % 16; n; --n)
+      keys.push_back(key());
+    std::sort(keys.begin(), keys.end(), std_.key_comp());
+
+    std::size_t erased = 0;
+    for (const auto& k : keys)
+      erased += std_.erase(k);
+    check(flat_.erase_keys(keys.begin(), keys.end()) == erased,
+          "erased count differs");
+    check_lookups(keys.empty() ? 0 : 1);
+    check_moves();
+  }
+
+  void erase_if() {
+    op_ = "erase_if";
+    std::uint8_t mod = input_.byte() % 8 + 1;
+    std::uint8_t rem = input_.byte() % mod;
+    std::size_t seen = 0;
+    auto pred = [&](const value_type&) { return seen++ % mod == rem; };
+
+    std::size_t erased = 0;
+    for (auto it = std_.begin(); it != std_.end();) {
+      if (pred(*it)) {
+        it = std_.erase(it);
+        ++erased;
+      } else {
+        ++it;
+      }
+    }
+    seen = 0;
+    check(tools::erase_if(flat_, pred) == erased, "erased count differs");
+    check_moves();
+  }
+
+  void copy_and_swap() {
+    op_ = "copy/swap";
+    FlatCont copy(flat_);
+    check(copy == flat_, "copy differs");
+    FlatCont other;
+    other.swap(copy);
+    check(copy.empty() && other == flat_, "swap differs");
+    if (input_.byte() % 4 == 0) {
+      flat_.clear();
+      std_.clear();
+    }
+  }
+
+  input_reader& input_;
+  FlatCont flat_;
+  StdCont std_;
+  std::size_t op_index_ = 0;
+  std::size_t size_before_ = 0;
+  const char* op_ = "";
+};
+
+using flat_map_t = tools::flat_map<int,
+                                   int,
+                                   std::less<int>,
+                                   std::vector<std::pair<int, int>>,
+                                   tools::counting_stats>;
+using flat_set_t = tools::flat_set<std::string,
+                                   std::greater<std::string>,
+                                   std::vector<std::string>,
+                                   tools::counting_stats>;
+
+void run_one(const std::uint8_t* data, std::size_t size) {
+  if (size == 0)
+    return;
+  input_reader input(data + 1, size - 1);
+  if (data[0] % 2) {
+    differential_test<flat_map_t, std::map<int, int>>(&input).run();
+  } else {
+    differential_test<flat_set_t,
+                      std::set<std::string, std::greater<std::string>>>(&input)
+        .run();
+  }
+}
+
+}  // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data,
+                                      std::size_t size) {
+  run_one(data, size);
+  return 0;
+}
+
+#ifndef FLAT_FUZZ_LIBFUZZER
+
+int main(int argc, char** argv) {
+  std::size_t runs = 10000;
+  std::uint64_t seed = 42;
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg.compare(0, 7, "--runs=") == 0)
+      runs = std::stoul(arg.substr(7));
+    else if (arg.compare(0, 7, "--seed=") == 0)
+      seed = std::stoull(arg.substr(7));
+    else
+      files.push_back(arg);
+  }
+
+  for (const auto& file : files) {
+    std::ifstream in(file, std::ios::binary);
+    std::vector<std::uint8_t> data((std::istreambuf_iterator<char>(in)),
+                                   std::istreambuf_iterator<char>());
+    run_one(data.data(), data.size());
+  }
+  if (!files.empty())
+    return 0;
+
+  std::mt19937_64 gen(seed);
+  std::vector<std::uint8_t> data;
+  for (std::size_t run = 0; run < runs; ++run) {
+    data.resize(gen() % 4096);
+    for (auto& byte : data)
+      byte = static_cast<std::uint8_t>(gen());
+    run_one(data.data(), data.size());
+  }
+  std::cout << runs << " random inputs passed" << std::endl;
+}
+
+#endif  // FLAT_FUZZ_LIBFUZZER
@@ -0,0 +1,102 @@
+#ifndef TOOLS_BLOCKED_BLOOM_FILTER_H_
+#define TOOLS_BLOCKED_BLOOM_FILTER_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace tools {
+
+// Bloom filter, where all bits of one key are in one 64 byte block, so a
+// check touches a single cache line. Works with 64 bit hashes, that the
+// caller mixes well enough, see mix_hash.
+//
+// With 10 bits per key false positive rate is about 1%, with 16 - 0.1%.
+class blocked_bloom_filter {
+  static constexpr std::size_t kWordsPerBlock = 8;
+  static constexpr std::size_t kBitsPerBlock = kWordsPerBlock * 64;
+
+ public:
+  blocked_bloom_filter() = default;
+
+  // sized for `keys` keys, bits_per_key bits each
+  blocked_bloom_filter(std::size_t keys, std::size_t bits_per_key)
+      : blocks_(std::max<std::size_t>(
+            1, (keys * bits_per_key + kBitsPerBlock - 1) / kBitsPerBlock)),
+        probes_(probes_for(bits_per_key)),
+        words_(blocks_ * kWordsPerBlock) {}
+
+  void add(std::uint64_t hash) {
+    std::uint64_t* block = block_for(hash);
+    for_each_bit(hash, [&](std::size_t bit) {
+      block[bit / 64] |= std::uint64_t(1) << (bit % 64);
+    });
+  }
+
+  // false - the key was never added, true - it probably was.
+  // an empty filter (not sized) answers true.
+  bool may_contain(std::uint64_t hash) const {
+    if (words_.empty())
+      return true;
+    const std::uint64_t* block = block_for(hash);
+    bool res = true;
+    for_each_bit(hash, [&](std::size_t bit) {
+      res &= (block[bit / 64] >> (bit % 64)) & 1;
+    });
+    return res;
+  }
+
+  std::size_t memory_bytes() const {
+    return words_.size() * sizeof(std::uint64_t);
+  }
+
+  // splitmix64 finalizer, std::hash of integers is identity.
+  static std::uint64_t mix_hash(std::uint64_t hash) {
+    hash ^= hash >> 30;
+    hash *= 0xbf58476d1ce4e5b9u;
+    hash ^= hash >> 27;
+    hash *= 0x94d049bb133111ebu;
+    hash ^= hash >> 31;
+    return hash;
+  }
+
+ private:
+  // k = bits_per_key * ln 2, rounded
+  static std::size_t probes_for(std::size_t bits_per_key) {
+    return std::min<std::size_t>(16, std::max<std::size_t>(
+                                         1, (bits_per_key * 69 + 50) / 100));
+  }
+
+  // high half of the hash picks the block, low half - bits in it.
+  std::uint64_t* block_for(std::uint64_t hash) {
+    return &words_[block_index(hash) * kWordsPerBlock];
+  }
+
+  const std::uint64_t* block_for(std::uint64_t hash) const {
+    return &words_[block_index(hash) * kWordsPerBlock];
+  }
+
+  std::size_t block_index(std::uint64_t hash) const {
+    return static_cast<std::size_t>(((hash >> 32) * blocks_) >> 32);
+  }
+
+  // double hashing: bit_i = h1 + i * h2
+  template <typename Op>
+  void for_each_bit(std::uint64_t hash, Op op) const {
+    auto h1 = static_cast<std::uint32_t>(hash);
+    auto h2 = static_cast<std::uint32_t>(hash >> 17) | 1;
+    for (std::size_t i = 0; i < probes_; ++i) {
+      op(h1 % kBitsPerBlock);
+      h1 += h2;
+    }
+  }
+
+  std::size_t blocks_ = 0;
+  std::size_t probes_ = 0;
+  std::vector<std::uint64_t> words_;
+};
+
+}  // namespace tools
+
+#endif  // TOOLS_BLOCKED_BLOOM_FILTER_H_
@@ -0,0 +1,293 @@
+#ifndef TOOLS_COMPRESSED_FLAT_SET_H_
+#define TOOLS_COMPRESSED_FLAT_SET_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "flat_set.h"
+
+namespace tools {
+
+// Read only flat_set of unsigned integers, compressed with frame of
+// reference: keys are split into blocks of BlockSize, each block keeps it's
+// first key (head) and bit packed differences from it, all of the same
+// width. A skip array of heads stays uncompressed.
+//
+// Every element of a block can be unpacked on it's own, so lookups are
+// a binary search over the heads and then a binary search in one block,
+// like std::lower_bound over a plain flat_set.
+//
+// Dense sorted ids take log2(BlockSize * average gap) bits instead of 64.
+template <typename UInt = std::uint64_t, std::size_t BlockSize = 128>
+class compressed_flat_set {
+  static_assert(std::is_unsigned<UInt>::value, "keys are unsigned integers");
+  static_assert(BlockSize > 0, "");
+
+ public:
+  using key_type = UInt;
+  using value_type = UInt;
+  using size_type = std::size_t;
+  using difference_type = std::ptrdiff_t;
+
+  // elements are unpacked on dereference, like in std::vector<bool>
+  class const_iterator {
+   public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = UInt;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = UInt;
+
+    const_iterator() = default;
+
+    reference operator*() const { return set_->get(idx_); }
+    reference operator[](difference_type n) const { return *(*this + n); }
+
+    const_iterator& operator++() {
+      ++idx_;
+      return *this;
+    }
+    const_iterator operator++(int) {
+      auto res = *this;
+      ++idx_;
+      return res;
+    }
+    const_iterator& operator--() {
+      --idx_;
+      return *this;
+    }
+    const_iterator operator--(int) {
+      auto res = *this;
+      --idx_;
+      return res;
+    }
+
+    const_iterator& operator+=(difference_type n) {
+      idx_ = static_cast<size_type>(static_cast<difference_type>(idx_) + n);
+      return *this;
+    }
+    const_iterator& operator-=(difference_type n) { return *this += -n; }
+
+    friend const_iterator operator+(const_iterator it, difference_type n) {
+      return it += n;
+    }
+    friend const_iterator operator+(difference_type n, const_iterator it) {
+      return it += n;
+    }
+    friend const_iterator operator-(const_iterator it, difference_type n) {
+      return it -= n;
+    }
+    friend difference_type operator-(const const_iterator& lhs,
+                                     const const_iterator& rhs) {
+      return static_cast<difference_type>(lhs.idx_) -
+             static_cast<difference_type>(rhs.idx_);
+    }
+
+    friend bool operator==(const const_iterator& lhs,
+                           const const_iterator& rhs) {
+      return lhs.idx_ == rhs.idx_;
+    }
+    friend bool operator!=(const const_iterator& lhs,
+                           const const_iterator& rhs) {
+      return lhs.idx_ != rhs.idx_;
+    }
+    friend bool operator<(const const_iterator& lhs,
+                          const const_iterator& rhs) {
+      return lhs.idx_ < rhs.idx_;
+    }
+    friend bool operator<=(const const_iterator& lhs,
+                           const const_iterator& rhs) {
+      return lhs.idx_ <= rhs.idx_;
+    }
+    friend bool operator>(const const_iterator& lhs,
+                          const const_iterator& rhs) {
+      return lhs.idx_ > rhs.idx_;
+    }
+    friend bool operator>=(const const_iterator& lhs,
+                           const const_iterator& rhs) {
+      return lhs.idx_ >= rhs.idx_;
+    }
+
+   private:
+    friend class compressed_flat_set;
+
+    const_iterator(const compressed_flat_set* set, size_type idx)
+        : set_(set), idx_(idx) {}
+
+    const compressed_flat_set* set_ = nullptr;
+    size_type idx_ = 0;
+  };
+
+  using iterator = const_iterator;
+
+  // ctors---------------------------------------------------------------------
+
+  compressed_flat_set() = default;
+
+  explicit compressed_flat_set(const flat_set<UInt>& set) {
+    assign(set.begin(), set.end());
+  }
+
+  template <typename It>
+  compressed_flat_set(It first, It last)
+      : compressed_flat_set(flat_set<UInt>(first, last)) {}
+
+  flat_set<UInt> decompress() const {
+    flat_set<UInt> res;
+    auto guard = res.unsafe_access();
+    guard->assign(begin(), end());
+    guard.release();
+    return res;
+  }
+
+  // iterators and size--------------------------------------------------------
+
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, size_); }
+  const_iterator cbegin() const { return begin(); }
+  const_iterator cend() const { return end(); }
+
+  bool empty() const { return size_ == 0; }
+  size_type size() const { return size_; }
+
+  std::size_t memory_bytes() const {
+    return heads_.size() * sizeof(UInt) +
+           offsets_.size() * sizeof(std::uint64_t) +
+           widths_.size() * sizeof(std::uint8_t) +
+           words_.size() * sizeof(std::uint64_t);
+  }
+
+  // lookups-------------------------------------------------------------------
+
+  const_iterator lower_bound(UInt key) const {
+    // last block, that starts not after the key
+    auto block = std::upper_bound(heads_.begin(), heads_.end(), key);
+    if (block == heads_.begin())
+      return begin();
+    auto b = static_cast<size_type>(block - heads_.begin()) - 1;
+    auto delta = static_cast<UInt>(key - heads_[b]);
+    size_type first = b * BlockSize;
+    size_type count = std::min(BlockSize, size_ - first);
+    // binary search of the delta in the block
+    while (count > 0) {
+      size_type half = count / 2;
+      if (unpack(b, first - b * BlockSize + half) < delta) {
+        first += half + 1;
+        count -= half + 1;
+      } else {
+        count = half;
+      }
+    }
+    return const_iterator(this, first);
+  }
+
+  const_iterator upper_bound(UInt key) const {
+    if (key == static_cast<UInt>(-1))
+      return end();
+    return lower_bound(static_cast<UInt>(key + 1));
+  }
+
+  std::pair<const_iterator, const_iterator> equal_range(UInt key) const {
+    auto first = lower_bound(key);
+    return {first, first != end() && *first == key ? first + 1 : first};
+  }
+
+  const_iterator find(UInt key) const {
+    auto pos = lower_bound(key);
+    return pos != end() && *pos == key ? pos : end();
+  }
+
+  size_type count(UInt key) const { return find(key) != end() ? 1 : 0; }
+
+  // regular-------------------------------------------------------------------
+
+  friend bool operator==(const compressed_flat_set& lhs,
+                         const compressed_flat_set& rhs) {
+    return lhs.size() == rhs.size() &&
+           std::equal(lhs.begin(), lhs.end(), rhs.begin());
+  }
+
+  friend bool operator!=(const compressed_flat_set& lhs,
+                         const compressed_flat_set& rhs) {
+    return !(lhs == rhs);
+  }
+
+ private:
+  UInt get(size_type idx) const {
+    auto b = idx / BlockSize;
+    return static_cast<UInt>(heads_[b] + unpack(b, idx % BlockSize));
+  }
+
+  // i-th difference in the block b
+  UInt unpack(size_type b, size_type i) const {
+    unsigned width = widths_[b];
+    if (width == 0)
+      return 0;
+    std::uint64_t bit = offsets_[b] + i * width;
+    std::size_t word = static_cast<std::size_t>(bit / 64);
+    unsigned shift = static_cast<unsigned>(bit % 64);
+    std::uint64_t res = words_[word] >> shift;
+    // words_ has a padding word, so the next one always exists
+    if (shift + width > 64)
+      res |= words_[word + 1] << (64 - shift);
+    if (width < 64)
+      res &= (std::uint64_t(1) << width) - 1;
+    return static_cast<UInt>(res);
+  }
+
+  void pack(std::uint64_t value, unsigned width, std::uint64_t bit) {
+    std::size_t word = static_cast<std::size_t>(bit / 64);
+    unsigned shift = static_cast<unsigned>(bit % 64);
+    words_[word] |= value << shift;
+    if (shift + width > 64)
+      words_[word + 1] |= value >> (64 - shift);
+  }
+
+  static unsigned bit_width(std::uint64_t value) {
+    unsigned res = 0;
+    for (; value; value >>= 1)
+      ++res;
+    return res;
+  }
+
+  // [first, last) is sorted and unique
+  template <typename It>
+  void assign(It first, It last) {
+    std::vector<UInt> keys(first, last);
+    size_ = keys.size();
+    std::uint64_t bits = 0;
+    for (size_type from = 0; from < keys.size(); from += BlockSize) {
+      size_type to = std::min(keys.size(), from + BlockSize);
+      unsigned width = bit_width(keys[to - 1] - keys[from]);
+      heads_.push_back(keys[from]);
+      offsets_.push_back(bits);
+      widths_.push_back(static_cast<std::uint8_t>(width));
+      bits += width * (to - from);
+    }
+    words_.assign(static_cast<std::size_t>((bits + 63) / 64) + 1, 0);
+    for (size_type b = 0; b < heads_.size(); ++b) {
+      size_type from = b * BlockSize;
+      size_type to = std::min(keys.size(), from + BlockSize);
+      for (size_type i = from; i < to; ++i) {
+        pack(keys[i] - heads_[b], widths_[b],
+             offsets_[b] + (i - from) * widths_[b]);
+      }
+    }
+  }
+
+  size_type size_ = 0;
+  std::vector<UInt> heads_;
+  // bit offset of each block in words_
+  std::vector<std::uint64_t> offsets_;
+  std::vector<std::uint8_t> widths_;
+  std::vector<std::uint64_t> words_;
+};
+
+}  // namespace tools
+
+#endif  // TOOLS_COMPRESSED_FLAT_SET_H_
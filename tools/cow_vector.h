@@ -0,0 +1,232 @@
+#ifndef TOOLS_COW_VECTOR_H_
+#define TOOLS_COW_VECTOR_H_
+
+#include <cstddef>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "flat_map.h"
+#include "flat_set.h"
+
+namespace tools {
+
+// std::vector with copy on write: copies share one reference counted body,
+// the first non const call detaches it by copying the elements. As
+// UnderlyingType of flat containers (cow_flat_map, cow_flat_set), copying
+// a container is O(1) and copies, that are never mutated, take no memory;
+// operator== of containers, that share a body, compares nothing.
+//
+// Every non const method detaches a shared body, so read through const
+// references: non const begin() or find() copy the elements just as
+// insert() does. Iterators into a shared body stay valid after the
+// container detaches, but point to the old version.
+//
+// Sharing is checked by use_count, so copies need a lock across threads.
+template <typename T>
+class cow_vector {
+  using body_type = std::vector<T>;
+
+ public:
+  using value_type = T;
+  using allocator_type = typename body_type::allocator_type;
+  using size_type = typename body_type::size_type;
+  using difference_type = typename body_type::difference_type;
+  using reference = typename body_type::reference;
+  using const_reference = typename body_type::const_reference;
+  using pointer = typename body_type::pointer;
+  using const_pointer = typename body_type::const_pointer;
+  using iterator = typename body_type::iterator;
+  using const_iterator = typename body_type::const_iterator;
+  using reverse_iterator = typename body_type::reverse_iterator;
+  using const_reverse_iterator = typename body_type::const_reverse_iterator;
+
+  // ctors---------------------------------------------------------------------
+
+  // empty vectors don't allocate
+  cow_vector() = default;
+
+  template <typename It>
+  cow_vector(It first, It last)
+      : body_(std::make_shared<body_type>(first, last)) {}
+
+  cow_vector(std::initializer_list<T> ilist)
+      : cow_vector(ilist.begin(), ilist.end()) {}
+
+  explicit cow_vector(body_type body)
+      : body_(std::make_shared<body_type>(std::move(body))) {}
+
+  // copies and moves of cow_vector itself are O(1)
+
+  // sharing-------------------------------------------------------------------
+
+  // vectors, that use the same elements
+  bool shares_body_with(const cow_vector& other) const {
+    return body_ == other.body_;
+  }
+
+  // number of vectors, sharing the body, 0 for an empty vector, that never
+  // allocated.
+  long use_count() const { return body_.use_count(); }
+
+  // the elements, detached, if they are shared.
+  body_type& detach() {
+    if (!body_)
+      body_ = std::make_shared<body_type>();
+    else if (body_.use_count() > 1)
+      body_ = std::make_shared<body_type>(*body_);
+    return *body_;
+  }
+
+  const body_type& get() const { return body_ ? *body_ : empty_body(); }
+
+  // reads---------------------------------------------------------------------
+
+  const_iterator begin() const { return get().begin(); }
+  const_iterator cbegin() const { return get().cbegin(); }
+  const_iterator end() const { return get().end(); }
+  const_iterator cend() const { return get().cend(); }
+
+  const_reverse_iterator rbegin() const { return get().rbegin(); }
+  const_reverse_iterator crbegin() const { return get().crbegin(); }
+  const_reverse_iterator rend() const { return get().rend(); }
+  const_reverse_iterator crend() const { return get().crend(); }
+
+  const_pointer data() const { return get().data(); }
+  const_reference operator[](size_type idx) const { return get()[idx]; }
+  const_reference back() const { return get().back(); }
+
+  bool empty() const { return get().empty(); }
+  size_type size() const { return get().size(); }
+  size_type max_size() const { return get().max_size(); }
+  size_type capacity() const { return get().capacity(); }
+
+  // writes, detach------------------------------------------------------------
+
+  iterator begin() { return detach().begin(); }
+  iterator end() { return detach().end(); }
+  reverse_iterator rbegin() { return detach().rbegin(); }
+  reverse_iterator rend() { return detach().rend(); }
+
+  pointer data() { return detach().data(); }
+  reference operator[](size_type idx) { return detach()[idx]; }
+  reference back() { return detach().back(); }
+
+  void reserve(size_type size) { detach().reserve(size); }
+
+  // doesn't copy shared elements just to destroy them
+  void clear() {
+    if (body_.use_count() > 1)
+      body_.reset();
+    else if (body_)
+      body_->clear();
+  }
+
+  template <typename It>
+  void assign(It first, It last) {
+    if (body_.use_count() > 1)
+      body_.reset();
+    detach().assign(first, last);
+  }
+
+  void push_back(const T& value) { detach().push_back(value); }
+  void push_back(T&& value) { detach().push_back(std::move(value)); }
+
+  template <typename... Args>
+  reference emplace_back(Args&&... args) {
+    auto& body = detach();
+    body.emplace_back(std::forward<Args>(args)...);
+    return body.back();
+  }
+
+  void pop_back() { detach().pop_back(); }
+
+  // positions may point into the shared body, so they are passed to the
+  // detached one as indexes
+
+  iterator insert(const_iterator pos, const T& value) {
+    auto idx = pos - cbegin();
+    auto& body = detach();
+    return body.insert(body.cbegin() + idx, value);
+  }
+
+  iterator insert(const_iterator pos, T&& value) {
+    auto idx = pos - cbegin();
+    auto& body = detach();
+    return body.insert(body.cbegin() + idx, std::move(value));
+  }
+
+  template <typename It>
+  iterator insert(const_iterator pos, It first, It last) {
+    auto idx = pos - cbegin();
+    auto& body = detach();
+    return body.insert(body.cbegin() + idx, first, last);
+  }
+
+  template <typename... Args>
+  iterator emplace(const_iterator pos, Args&&... args) {
+    auto idx = pos - cbegin();
+    auto& body = detach();
+    return body.emplace(body.cbegin() + idx, std::forward<Args>(args)...);
+  }
+
+  iterator erase(const_iterator pos) {
+    auto idx = pos - cbegin();
+    auto& body = detach();
+    return body.erase(body.cbegin() + idx);
+  }
+
+  iterator erase(const_iterator first, const_iterator last) {
+    auto from = first - cbegin();
+    auto to = last - cbegin();
+    auto& body = detach();
+    return body.erase(body.cbegin() + from, body.cbegin() + to);
+  }
+
+  void swap(cow_vector& other) noexcept { body_.swap(other.body_); }
+
+  // regular-------------------------------------------------------------------
+
+  friend bool operator==(const cow_vector& lhs, const cow_vector& rhs) {
+    return lhs.shares_body_with(rhs) || lhs.get() == rhs.get();
+  }
+
+  friend bool operator!=(const cow_vector& lhs, const cow_vector& rhs) {
+    return !(lhs == rhs);
+  }
+
+  friend bool operator<(const cow_vector& lhs, const cow_vector& rhs) {
+    return !lhs.shares_body_with(rhs) && lhs.get() < rhs.get();
+  }
+
+  friend void swap(cow_vector& lhs, cow_vector& rhs) noexcept {
+    lhs.swap(rhs);
+  }
+
+ private:
+  static const body_type& empty_body() {
+    static const body_type res;
+    return res;
+  }
+
+  std::shared_ptr<body_type> body_;
+};
+
+template <typename T>
+struct is_contiguous_container<cow_vector<T>> : std::true_type {};
+
+template <typename Key,
+          typename T,
+          class Compare = std::less<Key>,
+          class Stats = no_stats>
+using cow_flat_map =
+    flat_map<Key, T, Compare, cow_vector<std::pair<Key, T>>, Stats>;
+
+template <typename Key, class Compare = std::less<Key>, class Stats = no_stats>
+using cow_flat_set = flat_set<Key, Compare, cow_vector<Key>, Stats>;
+
+}  // namespace tools
+
+#endif  // TOOLS_COW_VECTOR_H_
@@ -0,0 +1,235 @@
+#ifndef TOOLS_FILTERED_FLAT_SET_H_
+#define TOOLS_FILTERED_FLAT_SET_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "blocked_bloom_filter.h"
+#include "flat_set.h"
+
+namespace tools {
+
+// flat_set with a blocked Bloom filter in front of find/count, for workloads
+// where most lookups miss: a definite miss costs one cache line instead of
+// a binary search.
+//
+// Hash must agree with Compare: keys, equivalent under Compare, have equal
+// hashes (std::hash and std::less are fine).
+//
+// The filter is built lazily by the first lookup after unsafe_access or after
+// the set outgrew it; inserts are added to a built filter, erased keys only
+// make it less precise until the next rebuild. So, the first lookup after
+// a mutation is not thread safe: call rebuild_filter() before sharing the set
+// between readers.
+template <typename Key,
+          class Compare = std::less<Key>,
+          class Hash = std::hash<Key>,
+          class UnderlyingType = std::vector<Key>>
+class filtered_flat_set {
+  struct filter_invalidator {
+    void operator()() const { self->invalidate_filter(); }
+    filtered_flat_set* self;
+  };
+
+ public:
+  using set_type = flat_set<Key, Compare, UnderlyingType>;
+
+  using key_type = typename set_type::key_type;
+  using value_type = typename set_type::value_type;
+  using size_type = typename set_type::size_type;
+  using key_compare = typename set_type::key_compare;
+  using iterator = typename set_type::iterator;
+  using const_iterator = typename set_type::const_iterator;
+  using underlying_type = typename set_type::underlying_type;
+  using unsafe_region =
+      internal::notifying_region<typename set_type::unsafe_region,
+                                 filter_invalidator>;
+
+  static constexpr std::size_t kDefaultBitsPerKey = 10;
+
+  // ctors---------------------------------------------------------------------
+
+  explicit filtered_flat_set(std::size_t bits_per_key = kDefaultBitsPerKey)
+      : bits_per_key_(bits_per_key) {}
+
+  explicit filtered_flat_set(set_type set,
+                             std::size_t bits_per_key = kDefaultBitsPerKey)
+      : set_(std::move(set)), bits_per_key_(bits_per_key) {}
+
+  template <typename It>
+  filtered_flat_set(It first,
+                    It last,
+                    std::size_t bits_per_key = kDefaultBitsPerKey)
+      : set_(first, last), bits_per_key_(bits_per_key) {}
+
+  // the set itself, for everything that doesn't need the filter
+  const set_type& set() const { return set_; }
+
+  // filter--------------------------------------------------------------------
+
+  // memory budget of the filter. 0 turns it off.
+  std::size_t bits_per_key() const { return bits_per_key_; }
+
+  void set_bits_per_key(std::size_t bits_per_key) {
+    bits_per_key_ = bits_per_key;
+    if (!bits_per_key_)
+      filter_ = blocked_bloom_filter();
+    invalidate_filter();
+  }
+
+  void rebuild_filter() const {
+    filter_ = bits_per_key_ ? blocked_bloom_filter(set_.size(), bits_per_key_)
+                            : blocked_bloom_filter();
+    if (bits_per_key_) {
+      for (const auto& key : set_)
+        filter_.add(hash(key));
+    }
+    filter_capacity_ = set_.size();
+    filter_keys_ = set_.size();
+    filter_valid_ = true;
+  }
+
+  std::size_t filter_memory_bytes() const { return filter_.memory_bytes(); }
+
+  // methods-------------------------------------------------------------------
+
+  // sorts the body and invalidates the filter at the end of the region, so
+  // a lookup inside the region doesn't leave a filter of a partial body
+  unsafe_region unsafe_access() {
+    return unsafe_region(set_.unsafe_access(), filter_invalidator{this});
+  }
+
+  const_iterator begin() const { return set_.begin(); }
+  const_iterator end() const { return set_.end(); }
+  const_iterator cbegin() const { return set_.cbegin(); }
+  const_iterator cend() const { return set_.cend(); }
+
+  bool empty() const { return set_.empty(); }
+  size_type size() const { return set_.size(); }
+
+  void clear() {
+    set_.clear();
+    invalidate_filter();
+  }
+
+  std::pair<const_iterator, bool> insert(const value_type& value) {
+    auto res = set_.insert(value);
+    if (res.second)
+      on_insert(value);
+    return res;
+  }
+
+  std::pair<const_iterator, bool> insert(value_type&& value) {
+    auto h = hash(value);
+    auto res = set_.insert(std::move(value));
+    if (res.second)
+      on_insert_hash(h);
+    return res;
+  }
+
+  template <class InputIt>
+  void insert(InputIt first, InputIt last) {
+    set_.insert(first, last);
+    invalidate_filter();
+  }
+
+  size_type erase(const key_type& key) { return set_.erase(key); }
+
+  const_iterator erase(const_iterator pos) { return set_.erase(pos); }
+
+  void swap(filtered_flat_set& other) {
+    using std::swap;
+    swap(set_, other.set_);
+    swap(bits_per_key_, other.bits_per_key_);
+    swap(filter_, other.filter_);
+    swap(filter_capacity_, other.filter_capacity_);
+    swap(filter_keys_, other.filter_keys_);
+    swap(filter_valid_, other.filter_valid_);
+  }
+
+  // lookups, filtered---------------------------------------------------------
+
+  size_type count(const key_type& key) const {
+    return may_contain(key) ? set_.count(key) : 0;
+  }
+
+  const_iterator find(const key_type& key) const {
+    return may_contain(key) ? set_.find(key) : set_.end();
+  }
+
+  // doesn't search the set
+  bool may_contain(const key_type& key) const {
+    if (!bits_per_key_)
+      return true;
+    if (!filter_valid_)
+      rebuild_filter();
+    return filter_.may_contain(hash(key));
+  }
+
+  // lookups, not filtered-----------------------------------------------------
+
+  const_iterator lower_bound(const key_type& key) const {
+    return set_.lower_bound(key);
+  }
+
+  const_iterator upper_bound(const key_type& key) const {
+    return set_.upper_bound(key);
+  }
+
+  std::pair<const_iterator, const_iterator> equal_range(
+      const key_type& key) const {
+    return set_.equal_range(key);
+  }
+
+  key_compare key_comp() const { return set_.key_comp(); }
+
+  // regular-------------------------------------------------------------------
+
+  friend bool operator==(const filtered_flat_set& lhs,
+                         const filtered_flat_set& rhs) {
+    return lhs.set_ == rhs.set_;
+  }
+
+  friend bool operator!=(const filtered_flat_set& lhs,
+                         const filtered_flat_set& rhs) {
+    return !(lhs == rhs);
+  }
+
+  friend void swap(filtered_flat_set& lhs, filtered_flat_set& rhs) {
+    lhs.swap(rhs);
+  }
+
+ private:
+  static std::uint64_t hash(const key_type& key) {
+    return blocked_bloom_filter::mix_hash(Hash()(key));
+  }
+
+  void invalidate_filter() { filter_valid_ = false; }
+
+  void on_insert(const key_type& key) { on_insert_hash(hash(key)); }
+
+  // a filter with twice the keys it was sized for is too imprecise,
+  // it's rebuilt. erased keys still count.
+  void on_insert_hash(std::uint64_t h) {
+    if (!filter_valid_ || !bits_per_key_)
+      return;
+    if (++filter_keys_ > 2 * filter_capacity_ + 64)
+      invalidate_filter();
+    else
+      filter_.add(h);
+  }
+
+  set_type set_;
+  std::size_t bits_per_key_;
+  mutable blocked_bloom_filter filter_;
+  mutable size_type filter_capacity_ = 0;
+  mutable size_type filter_keys_ = 0;
+  mutable bool filter_valid_ = false;
+};
+
+}  // namespace tools
+
+#endif  // TOOLS_FILTERED_FLAT_SET_H_
@@ -0,0 +1,335 @@
+#ifndef TOOLS_FLAT_CONTAINER_HASH_H_
+#define TOOLS_FLAT_CONTAINER_HASH_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <type_traits>
+#include <utility>
+
+#include "flat_map.h"
+#include "flat_set.h"
+
+namespace tools {
+
+// Hashing of flat containers as values: std::hash<flat_set<...>>,
+// std::hash<flat_map<...>>, so that they can be keys of unordered
+// containers, and hashed_flat_container, that caches the hash.
+//
+// Contiguous bodies of trivially comparable elements (see
+// is_trivially_comparable) are hashed as bytes, others element by element
+// with std::hash.
+
+namespace internal {
+
+inline std::uint64_t hash_rotl(std::uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+inline std::uint64_t hash_round(std::uint64_t acc, std::uint64_t word) {
+  return hash_rotl(acc + word * 0xc2b2ae3d27d4eb4fu, 31) * 0x9e3779b185ebca87u;
+}
+
+inline std::uint64_t hash_load(const unsigned char* p) {
+  std::uint64_t word;
+  std::memcpy(&word, p, sizeof(word));
+  return word;
+}
+
+}  // namespace internal
+
+// xxHash64 style: four independent lanes of 8 byte words, so that their
+// multiplications overlap.
+inline std::uint64_t hash_bytes(const void* data,
+                                std::size_t size,
+                                std::uint64_t seed = 0) {
+  constexpr std::uint64_t k1 = 0x9e3779b185ebca87u;
+  constexpr std::uint64_t k2 = 0xc2b2ae3d27d4eb4fu;
+  constexpr std::uint64_t k3 = 0x165667b19e3779f9u;
+
+  auto p = static_cast<const unsigned char*>(data);
+  const unsigned char* last = p + size;
+  std::uint64_t res;
+  if (size >= 32) {
+    std::uint64_t lane0 = seed + k1 + k2;
+    std::uint64_t lane1 = seed + k2;
+    std::uint64_t lane2 = seed;
+    std::uint64_t lane3 = seed - k1;
+    for (; last - p >= 32; p += 32) {
+      lane0 = internal::hash_round(lane0, internal::hash_load(p));
+      lane1 = internal::hash_round(lane1, internal::hash_load(p + 8));
+      lane2 = internal::hash_round(lane2, internal::hash_load(p + 16));
+      lane3 = internal::hash_round(lane3, internal::hash_load(p + 24));
+    }
+    res = internal::hash_rotl(lane0, 1) + internal::hash_rotl(lane1, 7) +
+          internal::hash_rotl(lane2, 12) + internal::hash_rotl(lane3, 18);
+    for (std::uint64_t lane : {lane0, lane1, lane2, lane3})
+      res = (res ^ internal::hash_round(0, lane)) * k1 + k3;
+  } else {
+    res = seed + k3;
+  }
+  res += size;
+  for (; last - p >= 8; p += 8)
+    res = internal::hash_rotl(
+              res ^ internal::hash_round(0, internal::hash_load(p)), 27) *
+              k1 +
+          k3;
+  for (; p != last; ++p)
+    res = internal::hash_rotl(res ^ (*p * k3), 11) * k1;
+
+  res ^= res >> 33;
+  res *= k2;
+  res ^= res >> 29;
+  res *= k3;
+  res ^= res >> 32;
+  return res;
+}
+
+namespace internal {
+
+inline std::uint64_t hash_combine(std::uint64_t seed, std::uint64_t value) {
+  return (seed ^ value) * 0x9e3779b97f4a7c15u + (seed >> 29);
+}
+
+template <typename T>
+std::uint64_t element_hash(const T& value) {
+  return std::hash<T>()(value);
+}
+
+template <typename First, typename Second>
+std::uint64_t element_hash(const std::pair<First, Second>& value) {
+  return hash_combine(element_hash(value.first), element_hash(value.second));
+}
+
+template <typename Cont>
+std::uint64_t hash_body(const Cont& cont, std::true_type /*bytes*/) {
+  if (cont.empty())
+    return hash_bytes(nullptr, 0);
+  return hash_bytes(&*cont.begin(), cont.size() * sizeof(*cont.begin()));
+}
+
+template <typename Cont>
+std::uint64_t hash_body(const Cont& cont, std::false_type /*bytes*/) {
+  std::uint64_t res = cont.size();
+  for (const auto& value : cont)
+    res = hash_combine(res, element_hash(value));
+  return hash_bytes(&res, sizeof(res));
+}
+
+}  // namespace internal
+
+// hash of the elements, equal containers have equal hashes
+template <typename Traits, class UnderlyingType, class Stats>
+std::size_t hash_value(
+    const internal::flat_sorted_container_base<Traits, UnderlyingType, Stats>&
+        cont) {
+  using cont_type =
+      internal::flat_sorted_container_base<Traits, UnderlyingType, Stats>;
+  return static_cast<std::size_t>(internal::hash_body(
+      cont,
+      std::integral_constant<bool, cont_type::trivially_comparable>{}));
+}
+
+// Read mostly flat_map/flat_set, that remembers it's hash: hashing is O(1)
+// after the first time, operator== rejects containers with different
+// hashes without comparing elements. Every mutation drops the hash.
+//
+// The hash is lazy, like the filter of filtered_flat_set: call hash() before
+// sharing the container between readers.
+template <typename Container>
+class hashed_flat_container {
+  struct hash_invalidator {
+    void operator()() const { self->invalidate(); }
+    hashed_flat_container* self;
+  };
+
+ public:
+  using container_type = Container;
+  using key_type = typename Container::key_type;
+  using value_type = typename Container::value_type;
+  using size_type = typename Container::size_type;
+  using key_compare = typename Container::key_compare;
+  using const_iterator = typename Container::const_iterator;
+  using iterator = const_iterator;
+  using unsafe_region =
+      internal::notifying_region<typename Container::unsafe_region,
+                                 hash_invalidator>;
+
+  // ctors---------------------------------------------------------------------
+
+  hashed_flat_container() = default;
+
+  explicit hashed_flat_container(Container cont) : cont_(std::move(cont)) {}
+
+  template <typename It>
+  hashed_flat_container(It first, It last) : cont_(first, last) {}
+
+  const Container& container() const { return cont_; }
+
+  // hash----------------------------------------------------------------------
+
+  std::size_t hash() const {
+    if (!hash_valid_) {
+      hash_ = hash_value(cont_);
+      hash_valid_ = true;
+    }
+    return hash_;
+  }
+
+  // methods-------------------------------------------------------------------
+
+  // drops the hash at the end of the region, so a hash() inside the region
+  // doesn't stay cached for the final body
+  unsafe_region unsafe_access() {
+    return unsafe_region(cont_.unsafe_access(), hash_invalidator{this});
+  }
+
+  const_iterator begin() const { return cont_.begin(); }
+  const_iterator end() const { return cont_.end(); }
+  const_iterator cbegin() const { return cont_.cbegin(); }
+  const_iterator cend() const { return cont_.cend(); }
+
+  bool empty() const { return cont_.empty(); }
+  size_type size() const { return cont_.size(); }
+
+  void clear() {
+    invalidate();
+    cont_.clear();
+  }
+
+  std::pair<const_iterator, bool> insert(const value_type& value) {
+    invalidate();
+    return cont_.insert(value);
+  }
+
+  std::pair<const_iterator, bool> insert(value_type&& value) {
+    invalidate();
+    return cont_.insert(std::move(value));
+  }
+
+  template <class InputIt>
+  void insert(InputIt first, InputIt last) {
+    invalidate();
+    cont_.insert(first, last);
+  }
+
+  template <class... Args>
+  std::pair<const_iterator, bool> emplace(Args&&... args) {  // NOLINT
+    invalidate();
+    return cont_.emplace(std::forward<Args>(args)...);
+  }
+
+  size_type erase(const key_type& key) {
+    invalidate();
+    return cont_.erase(key);
+  }
+
+  const_iterator erase(const_iterator pos) {
+    invalidate();
+    return cont_.erase(pos);
+  }
+
+  void swap(hashed_flat_container& other) {
+    using std::swap;
+    swap(cont_, other.cont_);
+    swap(hash_, other.hash_);
+    swap(hash_valid_, other.hash_valid_);
+  }
+
+  // lookups-------------------------------------------------------------------
+
+  size_type count(const key_type& key) const { return cont_.count(key); }
+
+  const_iterator find(const key_type& key) const { return cont_.find(key); }
+
+  const_iterator lower_bound(const key_type& key) const {
+    return cont_.lower_bound(key);
+  }
+
+  const_iterator upper_bound(const key_type& key) const {
+    return cont_.upper_bound(key);
+  }
+
+  std::pair<const_iterator, const_iterator> equal_range(
+      const key_type& key) const {
+    return cont_.equal_range(key);
+  }
+
+  // only for maps
+  template <typename C = Container>
+  const typename C::mapped_type& at(const key_type& key) const {
+    return cont_.at(key);
+  }
+
+  key_compare key_comp() const { return cont_.key_comp(); }
+
+  // regular-------------------------------------------------------------------
+
+  friend bool operator==(const hashed_flat_container& lhs,
+                         const hashed_flat_container& rhs) {
+    if (lhs.hash_valid_ && rhs.hash_valid_ && lhs.hash_ != rhs.hash_)
+      return false;
+    return lhs.cont_ == rhs.cont_;
+  }
+
+  friend bool operator!=(const hashed_flat_container& lhs,
+                         const hashed_flat_container& rhs) {
+    return !(lhs == rhs);
+  }
+
+  friend bool operator<(const hashed_flat_container& lhs,
+                        const hashed_flat_container& rhs) {
+    return lhs.cont_ < rhs.cont_;
+  }
+
+  friend void swap(hashed_flat_container& lhs, hashed_flat_container& rhs) {
+    lhs.swap(rhs);
+  }
+
+ private:
+  void invalidate() { hash_valid_ = false; }
+
+  Container cont_;
+  mutable std::size_t hash_ = 0;
+  mutable bool hash_valid_ = false;
+};
+
+template <typename Key, typename T, class Compare = std::less<Key>>
+using hashed_flat_map = hashed_flat_container<flat_map<Key, T, Compare>>;
+
+template <typename Key, class Compare = std::less<Key>>
+using hashed_flat_set = hashed_flat_container<flat_set<Key, Compare>>;
+
+}  // namespace tools
+
+namespace std {
+
+template <typename Key, class Compare, class UnderlyingType, class Stats>
+struct hash<tools::flat_set<Key, Compare, UnderlyingType, Stats>> {
+  size_t operator()(
+      const tools::flat_set<Key, Compare, UnderlyingType, Stats>& set) const {
+    return tools::hash_value(set);
+  }
+};
+
+template <typename Traits, class UnderlyingType, class Stats>
+struct hash<tools::internal::flat_map_base<Traits, UnderlyingType, Stats>> {
+  size_t operator()(
+      const tools::internal::flat_map_base<Traits, UnderlyingType, Stats>& map)
+      const {
+    return tools::hash_value(map);
+  }
+};
+
+template <typename Container>
+struct hash<tools::hashed_flat_container<Container>> {
+  size_t operator()(const tools::hashed_flat_container<Container>& cont) const {
+    return cont.hash();
+  }
+};
+
+}  // namespace std
+
+#endif  // TOOLS_FLAT_CONTAINER_HASH_H_
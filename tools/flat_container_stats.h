@@ -0,0 +1,255 @@
+#ifndef TOOLS_FLAT_CONTAINER_STATS_H_
+#define TOOLS_FLAT_CONTAINER_STATS_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+namespace tools {
+
+// Stats policies for flat containers: last template parameter of
+// flat_map/flat_set. Hooks are const, so that const lookups are counted too.
+//
+// no_stats    - default, every hook is empty and compiles away.
+// basic_stats - counters and, optionally, per operation latency histograms.
+//
+// Counters are relaxed atomics: concurrent readers of a container do not race
+// on them, but a snapshot is not a consistent cut.
+
+enum class stats_op {
+  find,
+  count,
+  lower_bound,
+  upper_bound,
+  equal_range,
+  insert,
+  insert_range,
+  erase,
+  erase_bulk,
+  sort,
+};
+
+constexpr std::size_t kStatsOps = static_cast<std::size_t>(stats_op::sort) + 1;
+
+struct latency_histogram {
+  static constexpr std::size_t kBuckets = 40;
+
+  // buckets[i] - operations, that took [2^i, 2^(i + 1)) nanoseconds,
+  // bucket 0 also has operations faster than a nanosecond.
+  std::uint64_t buckets[kBuckets] = {};
+
+  std::uint64_t count() const {
+    std::uint64_t res = 0;
+    for (std::uint64_t bucket : buckets)
+      res += bucket;
+    return res;
+  }
+};
+
+struct stats_snapshot {
+  std::uint64_t lookups = 0;
+  std::uint64_t comparisons = 0;
+  std::uint64_t max_comparisons = 0;
+  std::uint64_t inserted = 0;
+  std::uint64_t erased = 0;
+  std::uint64_t elements_moved = 0;
+  std::uint64_t reallocations = 0;
+  std::uint64_t sorts = 0;
+  std::uint64_t sorted_elements = 0;
+  latency_histogram latencies[kStatsOps];
+
+  const latency_histogram& latency(stats_op op) const {
+    return latencies[static_cast<std::size_t>(op)];
+  }
+};
+
+struct no_stats {
+  static constexpr bool enabled = false;
+
+  struct timer {};
+
+  timer start(stats_op) const { return {}; }
+  void finish(stats_op, const timer&) const {}
+
+  void on_lookup(std::size_t /*comparisons*/) const {}
+  void on_insert(std::size_t /*inserted*/, std::size_t /*moved*/) const {}
+  void on_erase(std::size_t /*erased*/, std::size_t /*moved*/) const {}
+  void on_reallocation() const {}
+  void on_sort(std::size_t /*elements*/) const {}
+
+  stats_snapshot snapshot() const { return {}; }
+  void reset() {}
+};
+
+template <bool Latencies = false>
+class basic_stats {
+  using clock = std::chrono::steady_clock;
+  using counter = std::atomic<std::uint64_t>;
+
+  static constexpr std::size_t kHistograms = Latencies ? kStatsOps : 0;
+
+  struct empty_timer {};
+
+ public:
+  static constexpr bool enabled = true;
+
+  using timer = typename std::
+      conditional<Latencies, clock::time_point, empty_timer>::type;
+
+  basic_stats() { reset(); }
+
+  // copies start from the same numbers, but count separately
+  basic_stats(const basic_stats& that) { assign(that.snapshot()); }
+
+  basic_stats& operator=(const basic_stats& that) {
+    assign(that.snapshot());
+    return *this;
+  }
+
+  timer start(stats_op) const {
+    return start(std::integral_constant<bool, Latencies>{});
+  }
+
+  void finish(stats_op op, const timer& started) const {
+    finish(op, started, std::integral_constant<bool, Latencies>{});
+  }
+
+  void on_lookup(std::size_t comparisons) const {
+    add(lookups_, 1);
+    add(comparisons_, comparisons);
+    auto max = max_comparisons_.load(std::memory_order_relaxed);
+    while (max < comparisons &&
+           !max_comparisons_.compare_exchange_weak(max, comparisons,
+                                                   std::memory_order_relaxed)) {
+    }
+  }
+
+  void on_insert(std::size_t inserted, std::size_t moved) const {
+    add(inserted_, inserted);
+    add(elements_moved_, moved);
+  }
+
+  void on_erase(std::size_t erased, std::size_t moved) const {
+    add(erased_, erased);
+    add(elements_moved_, moved);
+  }
+
+  void on_reallocation() const { add(reallocations_, 1); }
+
+  void on_sort(std::size_t elements) const {
+    add(sorts_, 1);
+    add(sorted_elements_, elements);
+  }
+
+  stats_snapshot snapshot() const {
+    stats_snapshot res;
+    res.lookups = load(lookups_);
+    res.comparisons = load(comparisons_);
+    res.max_comparisons = load(max_comparisons_);
+    res.inserted = load(inserted_);
+    res.erased = load(erased_);
+    res.elements_moved = load(elements_moved_);
+    res.reallocations = load(reallocations_);
+    res.sorts = load(sorts_);
+    res.sorted_elements = load(sorted_elements_);
+    for (std::size_t op = 0; op < kHistograms; ++op) {
+      for (std::size_t i = 0; i < latency_histogram::kBuckets; ++i)
+        res.latencies[op].buckets[i] = load(latencies_[op][i]);
+    }
+    return res;
+  }
+
+  void reset() { assign(stats_snapshot()); }
+
+ private:
+  static void add(counter& c, std::uint64_t value) {
+    c.fetch_add(value, std::memory_order_relaxed);
+  }
+
+  static std::uint64_t load(const counter& c) {
+    return c.load(std::memory_order_relaxed);
+  }
+
+  static void store(counter& c, std::uint64_t value) {
+    c.store(value, std::memory_order_relaxed);
+  }
+
+  void assign(const stats_snapshot& values) {
+    store(lookups_, values.lookups);
+    store(comparisons_, values.comparisons);
+    store(max_comparisons_, values.max_comparisons);
+    store(inserted_, values.inserted);
+    store(erased_, values.erased);
+    store(elements_moved_, values.elements_moved);
+    store(reallocations_, values.reallocations);
+    store(sorts_, values.sorts);
+    store(sorted_elements_, values.sorted_elements);
+    for (std::size_t op = 0; op < kHistograms; ++op) {
+      for (std::size_t i = 0; i < latency_histogram::kBuckets; ++i)
+        store(latencies_[op][i], values.latencies[op].buckets[i]);
+    }
+  }
+
+  timer start(std::false_type /*latencies*/) const { return {}; }
+  timer start(std::true_type /*latencies*/) const { return clock::now(); }
+
+  void finish(stats_op, const timer&, std::false_type /*latencies*/) const {}
+
+  void finish(stats_op op,
+              const timer& started,
+              std::true_type /*latencies*/) const {
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  clock::now() - started)
+                  .count();
+    std::size_t bucket = 0;
+    while (ns > 1 && bucket + 1 < latency_histogram::kBuckets) {
+      ns >>= 1;
+      ++bucket;
+    }
+    add(latencies_[static_cast<std::size_t>(op)][bucket], 1);
+  }
+
+  mutable counter lookups_;
+  mutable counter comparisons_;
+  mutable counter max_comparisons_;
+  mutable counter inserted_;
+  mutable counter erased_;
+  mutable counter elements_moved_;
+  mutable counter reallocations_;
+  mutable counter sorts_;
+  mutable counter sorted_elements_;
+  // a single unused histogram without latencies, arrays can't be empty
+  mutable counter latencies_[Latencies ? kStatsOps : 1]
+                            [latency_histogram::kBuckets];
+};
+
+using counting_stats = basic_stats<false>;
+using timing_stats = basic_stats<true>;
+
+namespace internal {
+
+// measures one operation of a container
+template <typename Stats>
+class stats_scope {
+ public:
+  stats_scope(const Stats& stats, stats_op op)
+      : stats_(stats), op_(op), timer_(stats.start(op)) {}
+
+  stats_scope(const stats_scope&) = delete;
+  stats_scope& operator=(const stats_scope&) = delete;
+
+  ~stats_scope() { stats_.finish(op_, timer_); }
+
+ private:
+  const Stats& stats_;
+  stats_op op_;
+  typename Stats::timer timer_;
+};
+
+}  // namespace internal
+
+}  // namespace tools
+
+#endif  // TOOLS_FLAT_CONTAINER_STATS_H_
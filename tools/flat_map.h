@@ -1,7 +1,10 @@
 #ifndef TOOLS_FLAT_MAP_H_
 #define TOOLS_FLAT_MAP_H_
 
+#include <iterator>
 #include <map>
+#include <stdexcept>
+#include <tuple>
 #include <utility>
 #include <vector>
 
@@ -17,6 +20,9 @@ struct base_map_traits : private Compare {
   using mapped_type = T;
   using value_type = std::pair<key_type, T>;
 
+  base_map_traits() = default;
+  explicit base_map_traits(const Compare& comp) : Compare(comp) {}
+
   bool cmp(const key_type& lhs, const key_type& rhs) const {
     return Compare::operator()(lhs, rhs);
   }
@@ -38,6 +44,25 @@ struct base_map_traits : private Compare {
     return !cmp(lhs, rhs) && !cmp(rhs, lhs);
   }
 
+  static constexpr bool has_three_way =
+      three_way_compare<Compare, key_type>::enabled;
+
+  int three_way(const key_type& lhs, const key_type& rhs) const {
+    return three_way_compare<Compare, key_type>()(lhs, rhs);
+  }
+
+  int three_way(const value_type& lhs, const key_type& rhs) const {
+    return three_way(lhs.first, rhs);
+  }
+
+  int three_way(const key_type& lhs, const value_type& rhs) const {
+    return three_way(lhs, rhs.first);
+  }
+
+  int three_way(const value_type& lhs, const value_type& rhs) const {
+    return three_way(lhs.first, rhs.first);
+  }
+
   const key_type& key_from_value(const value_type& value) {
     return value.first;
   }
@@ -47,10 +72,10 @@ struct base_map_traits : private Compare {
 
 // std::vector is not particulary friendly with const value type,
 // so, unlike std::map, we use non const Key
-template <typename Traits, class UnderlyingType>
+template <typename Traits, class UnderlyingType, class Stats = no_stats>
 class flat_map_base
-    : public flat_sorted_container_base<Traits, UnderlyingType> {
-  using base_type = flat_sorted_container_base<Traits, UnderlyingType>;
+    : public flat_sorted_container_base<Traits, UnderlyingType, Stats> {
+  using base_type = flat_sorted_container_base<Traits, UnderlyingType, Stats>;
 
  public:
   // typedefs------------------------------------------------------------------
@@ -59,15 +84,23 @@ class flat_map_base
   using std_map = typename Traits::std_map;
   using mapped_type = typename Traits::mapped_type;
   using key_type = typename base_type::key_type;
+  using value_type = typename base_type::value_type;
+  using iterator = typename base_type::iterator;
+  using const_iterator = typename base_type::const_iterator;
+  // const for views, their iterators are const
+  using mapped_reference = decltype((std::declval<iterator>()->second));
 
   // ctors---------------------------------------------------------------------
   using base_type::base_type;
 
   // methods-------------------------------------------------------------------
 
-  mapped_type& at(const key_type& key) {
-    return const_cast<mapped_type&>(
-        static_cast<const flat_map_base&>(*this).at(key));
+  // non const find, so that bodies with copy on write detach
+  mapped_reference at(const key_type& key) {
+    auto pos = this->find(key);
+    if (pos == this->end())
+      throw std::out_of_range("flat_map::at");
+    return pos->second;
   }
 
   const mapped_type& at(const key_type& key) const {
@@ -77,16 +110,144 @@ class flat_map_base
     return pos->second;
   }
 
-  mapped_type& operator[](key_type key) {
-    auto pos = this->lower_bound(key);
-    if (pos != this->end() && this->key_value_comp().equal(*pos, key)) {
-      return pos->second;
+  mapped_type& operator[](const key_type& key) {
+    return try_emplace(key).first->second;
+  }
+
+  mapped_type& operator[](key_type&& key) {
+    return try_emplace(std::move(key)).first->second;
+  }
+
+  // mapped_type is constructed only if the key is not in the map
+  template <class... Args>
+  std::pair<iterator, bool> try_emplace(const key_type& key, Args&&... args) {
+    return try_emplace_impl(key, std::forward<Args>(args)...);
+  }
+
+  template <class... Args>
+  std::pair<iterator, bool> try_emplace(key_type&& key, Args&&... args) {
+    return try_emplace_impl(std::move(key), std::forward<Args>(args)...);
+  }
+
+  // if the key goes right before hint, it's inserted there without a search
+  template <class... Args>
+  iterator try_emplace(const_iterator hint,
+                       const key_type& key,
+                       Args&&... args) {
+    if (!this->fits_before(hint, key))
+      return try_emplace_impl(key, std::forward<Args>(args)...).first;
+    return emplace_at(hint, key, std::forward<Args>(args)...);
+  }
+
+  template <class... Args>
+  iterator try_emplace(const_iterator hint, key_type&& key, Args&&... args) {
+    if (!this->fits_before(hint, key))
+      return try_emplace_impl(std::move(key), std::forward<Args>(args)...)
+          .first;
+    return emplace_at(hint, std::move(key), std::forward<Args>(args)...);
+  }
+
+  template <class M>
+  std::pair<iterator, bool> insert_or_assign(const key_type& key, M&& obj) {
+    return insert_or_assign_impl(key, std::forward<M>(obj));
+  }
+
+  template <class M>
+  std::pair<iterator, bool> insert_or_assign(key_type&& key, M&& obj) {
+    return insert_or_assign_impl(std::move(key), std::forward<M>(obj));
+  }
+
+  template <class M>
+  iterator insert_or_assign(const_iterator hint, const key_type& key, M&& obj) {
+    if (!this->fits_before(hint, key))
+      return insert_or_assign_impl(key, std::forward<M>(obj)).first;
+    return emplace_at(hint, key, std::forward<M>(obj));
+  }
+
+  template <class M>
+  iterator insert_or_assign(const_iterator hint, key_type&& key, M&& obj) {
+    if (!this->fits_before(hint, key))
+      return insert_or_assign_impl(std::move(key), std::forward<M>(obj)).first;
+    return emplace_at(hint, std::move(key), std::forward<M>(obj));
+  }
+
+  // batched aggregation, instead of `map[key] = combine(map[key], value)`
+  // per element: the batch of key/value pairs is sorted, values with the
+  // same key are combined in the order of the batch, then it's merged into
+  // the map in one pass. combine(existing, incoming) returns the new mapped
+  // value for keys, that are already in the map.
+  //
+  // combine must be associative: a key with values a, b in the batch gets
+  // combine(existing, combine(a, b)), not combine(combine(existing, a), b).
+  //
+  //   counts.upsert_many(batch.begin(), batch.end(), std::plus<>());
+  template <class InputIt, class Combine>
+  void upsert_many(InputIt first, InputIt last, Combine combine) {
+    this->upsert_range(first, last, combine_mapped(combine), false);
+  }
+
+  // same, for a batch, that is already a map
+  template <class Combine>
+  void merge_with(const flat_map_base& other, Combine combine) {
+    if (&other == this) {
+      flat_map_base copy(other);
+      merge_with(std::move(copy), combine);
+      return;
+    }
+    this->upsert_range(other.begin(), other.end(), combine_mapped(combine),
+                       true);
+  }
+
+  template <class Combine>
+  void merge_with(flat_map_base&& other, Combine combine) {
+    this->upsert_range(std::make_move_iterator(other.begin()),
+                       std::make_move_iterator(other.end()),
+                       combine_mapped(combine), true);
+  }
+
+ private:
+  template <class Combine>
+  static auto combine_mapped(Combine& combine) {
+    return [&combine](value_type& existing, value_type&& incoming) {
+      existing.second =
+          combine(std::move(existing.second), std::move(incoming.second));
+    };
+  }
+
+  template <typename K, class... Args>
+  iterator emplace_at(const_iterator pos, K&& key, Args&&... args) {
+    stats_scope<Stats> scope(this->stats(), stats_op::insert);
+    return this->insert_at(
+        pos, value_type(std::piecewise_construct,
+                        std::forward_as_tuple(std::forward<K>(key)),
+                        std::forward_as_tuple(std::forward<Args>(args)...)));
+  }
+
+  template <typename K, class... Args>
+  std::pair<iterator, bool> try_emplace_impl(K&& key, Args&&... args) {
+    stats_scope<Stats> scope(this->stats(), stats_op::insert);
+    auto found = this->lower_bound_equal(key);
+    if (found.second)
+      return std::make_pair(found.first, false);
+    auto pos = this->insert_at(
+        found.first,
+        value_type(std::piecewise_construct,
+                   std::forward_as_tuple(std::forward<K>(key)),
+                   std::forward_as_tuple(std::forward<Args>(args)...)));
+    return std::make_pair(pos, true);
+  }
+
+  template <typename K, class M>
+  std::pair<iterator, bool> insert_or_assign_impl(K&& key, M&& obj) {
+    stats_scope<Stats> scope(this->stats(), stats_op::insert);
+    auto found = this->lower_bound_equal(key);
+    if (found.second) {
+      found.first->second = std::forward<M>(obj);
+      return std::make_pair(found.first, false);
     }
-    auto guard = this->unsafe_access();
-    mapped_type& res =
-        guard->emplace(pos, std::move(key), mapped_type())->second;
-    guard.release();
-    return res;
+    auto pos = this->insert_at(
+        found.first, value_type(std::forward<K>(key), std::forward<M>(obj)));
+    return std::make_pair(pos, true);
   }
 };
 
@@ -108,9 +269,11 @@ class flat_map_traits
 template <typename Key,
           typename T,
           class Compare = std::less<Key>,
-          class UnderlyingType = std::vector<std::pair<Key, T>>>
-using flat_map =
-    internal::flat_map_base<flat_map_traits<Key, T, Compare>, UnderlyingType>;
+          class UnderlyingType = std::vector<std::pair<Key, T>>,
+          class Stats = no_stats>
+using flat_map = internal::flat_map_base<flat_map_traits<Key, T, Compare>,
+                                         UnderlyingType,
+                                         Stats>;
 
 }  // namespace tools
 
@@ -26,6 +26,13 @@ struct set_compare : private Compare,
     return !cmp(lhs, rhs) && !cmp(rhs, lhs);
   }
 
+  static constexpr bool has_three_way =
+      three_way_compare<Compare, key_type>::enabled;
+
+  int three_way(const key_type& lhs, const key_type& rhs) const {
+    return three_way_compare<Compare, key_type>()(lhs, rhs);
+  }
+
   const key_type& key_from_value(const value_type& value) const {
     return value;
   }
@@ -39,13 +46,16 @@ struct set_compare : private Compare,
 // so, unlike std::map, we use non const Key
 template <typename Key,
           class Compare = std::less<Key>,
-          class UnderlyingType = std::vector<Key>>
+          class UnderlyingType = std::vector<Key>,
+          class Stats = no_stats>
 class flat_set : public internal::flat_sorted_container_base<
                      internal::set_compare<Key, Compare>,
-                     UnderlyingType> {
+                     UnderlyingType,
+                     Stats> {
   using base_type =
       internal::flat_sorted_container_base<internal::set_compare<Key, Compare>,
-                                           UnderlyingType>;
+                                           UnderlyingType,
+                                           Stats>;
 
  public:
   using base_type::base_type;
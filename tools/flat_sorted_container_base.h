@@ -2,13 +2,170 @@
 #define TOOLS_FLAT_SORTED_CONTAINER_BASE_H_
 
 #include <algorithm>
+#include <cstring>
+#include <functional>
 #include <memory>
+#include <string>
+#include <type_traits>
 #include <utility>
+#include <vector>
 #include <cassert>
 
+#include "flat_container_stats.h"
+
 namespace tools {
+
+// Tag for constructors, that take a body, already sorted and without
+// duplicates: it's not sorted again, so the body can be read only.
+struct sorted_unique_t {
+  explicit sorted_unique_t() = default;
+};
+
+constexpr sorted_unique_t sorted_unique{};
+
+// Type can be moved to a new address by copying it's bytes and forgetting
+// the source. Specialize for your own types (most strings, owning pointers,
+// and so on), flat containers use it to shift elements with memmove.
+template <typename T>
+struct is_trivially_relocatable : std::is_trivially_copyable<T> {};
+
+template <typename First, typename Second>
+struct is_trivially_relocatable<std::pair<First, Second>>
+    : std::integral_constant<bool,
+                             is_trivially_relocatable<First>::value &&
+                                 is_trivially_relocatable<Second>::value> {};
+
+// Equality of T is equality of it's bytes: no padding, no floating point,
+// no pointers to compare through. Flat containers of such elements compare
+// and hash their bodies with memcmp and byte hashing. Specialize for your
+// own types.
+template <typename T>
+struct is_trivially_comparable
+    : std::integral_constant<bool,
+                             std::is_integral<T>::value ||
+                                 std::is_enum<T>::value ||
+                                 std::is_pointer<T>::value> {};
+
+template <typename First, typename Second>
+struct is_trivially_comparable<std::pair<First, Second>>
+    : std::integral_constant<bool,
+                             is_trivially_comparable<First>::value &&
+                                 is_trivially_comparable<Second>::value &&
+                                 sizeof(std::pair<First, Second>) ==
+                                     sizeof(First) + sizeof(Second)> {};
+
+// Container stores it's elements in one array. Specialize for your own
+// vector-like types.
+template <typename Cont>
+struct is_contiguous_container : std::false_type {};
+
+template <typename T, typename Alloc>
+struct is_contiguous_container<std::vector<T, Alloc>> : std::true_type {};
+
+template <typename Alloc>
+struct is_contiguous_container<std::vector<bool, Alloc>> : std::false_type {};
+
+// Compare, that can tell ordering and equality of two keys in one call:
+// negative if lhs < rhs, zero if they are equivalent, positive otherwise.
+// Specialize for your own comparators with
+//   static constexpr bool enabled = true;
+//   int operator()(const Key& lhs, const Key& rhs) const;
+template <typename Compare, typename Key>
+struct three_way_compare {
+  static constexpr bool enabled = false;
+};
+
+template <typename CharT, typename CharTraits, typename Alloc>
+struct three_way_compare<std::less<std::basic_string<CharT, CharTraits, Alloc>>,
+                         std::basic_string<CharT, CharTraits, Alloc>> {
+  static constexpr bool enabled = true;
+
+  int operator()(const std::basic_string<CharT, CharTraits, Alloc>& lhs,
+                 const std::basic_string<CharT, CharTraits, Alloc>& rhs) const {
+    return lhs.compare(rhs);
+  }
+};
+
+template <typename CharT, typename CharTraits, typename Alloc>
+struct three_way_compare<
+    std::greater<std::basic_string<CharT, CharTraits, Alloc>>,
+    std::basic_string<CharT, CharTraits, Alloc>> {
+  static constexpr bool enabled = true;
+
+  int operator()(const std::basic_string<CharT, CharTraits, Alloc>& lhs,
+                 const std::basic_string<CharT, CharTraits, Alloc>& rhs) const {
+    return rhs.compare(lhs);
+  }
+};
+
 namespace internal {
 
+// Traits, that define `static constexpr bool has_three_way = true`, also
+// provide `int three_way(lhs, rhs)` for the same arguments as cmp.
+template <typename Traits, typename = void>
+struct has_three_way : std::false_type {};
+
+template <typename Traits>
+struct has_three_way<Traits,
+                     typename std::enable_if<Traits::has_three_way>::type>
+    : std::true_type {};
+
+// Finds the key among emplace arguments, so that value_type is not
+// constructed for keys, that are already in the container.
+template <typename Key, typename Value, typename... Args>
+struct key_extractor : std::false_type {};
+
+// set: value is the key
+template <typename Key, typename Arg>
+struct key_extractor<Key, Key, Arg>
+    : std::is_same<Key, typename std::decay<Arg>::type> {
+  static const Key& get(const Key& key) { return key; }
+};
+
+// map: emplace(key, mapped)
+template <typename Key, typename T, typename KeyArg, typename MappedArg>
+struct key_extractor<Key, std::pair<Key, T>, KeyArg, MappedArg>
+    : std::is_same<Key, typename std::decay<KeyArg>::type> {
+  template <typename Mapped>
+  static const Key& get(const Key& key, const Mapped&) {
+    return key;
+  }
+};
+
+template <typename Key, typename Pair>
+struct is_pair_with_key : std::false_type {};
+
+template <typename Key, typename First, typename Second>
+struct is_pair_with_key<Key, std::pair<First, Second>>
+    : std::is_same<Key, typename std::remove_const<First>::type> {};
+
+// map: emplace(pair)
+template <typename Key, typename T, typename PairArg>
+struct key_extractor<Key, std::pair<Key, T>, PairArg>
+    : is_pair_with_key<Key, typename std::decay<PairArg>::type> {
+  template <typename First, typename Second>
+  static const Key& get(const std::pair<First, Second>& pair) {
+    return pair.first;
+  }
+};
+
+// moves element from |from| to |to|, shifting everything in between by one.
+// T has to be trivially relocatable.
+template <typename T>
+void rotate_one_relocatable(T* from, T* to) {
+  if (from == to)
+    return;
+  typename std::aligned_storage<sizeof(T), alignof(T)>::type buf;
+  std::memcpy(&buf, static_cast<void*>(from), sizeof(T));
+  if (from < to)
+    std::memmove(static_cast<void*>(from), static_cast<void*>(from + 1),
+                 static_cast<std::size_t>(to - from) * sizeof(T));
+  else
+    std::memmove(static_cast<void*>(to + 1), static_cast<void*>(to),
+                 static_cast<std::size_t>(from - to) * sizeof(T));
+  std::memcpy(static_cast<void*>(to), &buf, sizeof(T));
+}
+
 template <typename DerivedTraits>
 struct std_unique_traits {
   using traits = DerivedTraits;
@@ -37,37 +194,164 @@ struct std_sort_traits {
   }
 };
 
-template <typename Traits>
+template <typename Traits, class Stats>
 struct sort_and_unique : private Traits {
   using traits = Traits;
 
   // inheriting a constructor doesn't work for some reason
-  sort_and_unique(traits tr) : Traits(std::move(tr)) {}
+  sort_and_unique(traits tr, const Stats& stats)
+      : Traits(std::move(tr)), stats_(&stats) {}
 
   template <typename Cont>
   void operator()(Cont* rhs) {
+    stats_scope<Stats> scope(*stats_, stats_op::sort);
+    stats_->on_sort(rhs->size());
     Traits::sort_range(rhs->begin(), rhs->end());
     Traits::erase_non_unique(*rhs);
   }
+
+ private:
+  const Stats* stats_;
 };
 
-template <typename Traits, class UnderlyingType>
-class flat_sorted_container_base : private Traits {
+// unsafe_region of a wrapped container, that calls on_end() after the body
+// is sorted, or after release(): for wrappers, that cache something computed
+// from the body.
+template <typename Region, typename OnEnd>
+class notifying_region {
+ public:
+  using pointer = typename Region::pointer;
+  using element_type = typename Region::element_type;
+
+  notifying_region(Region region, OnEnd on_end)
+      : region_(std::move(region)), on_end_(std::move(on_end)) {}
+
+  notifying_region(notifying_region&&) = default;
+
+  notifying_region& operator=(notifying_region&& that) {
+    reset();
+    region_ = std::move(that.region_);
+    on_end_ = std::move(that.on_end_);
+    return *this;
+  }
+
+  ~notifying_region() { reset(); }
+
+  element_type& operator*() const { return *region_; }
+  pointer operator->() const { return region_.get(); }
+  pointer get() const { return region_.get(); }
+  explicit operator bool() const { return static_cast<bool>(region_); }
+
+  // the body is already sorted and unified, as with unsafe_region::release()
+  pointer release() {
+    auto res = region_.release();
+    if (res)
+      on_end_();
+    return res;
+  }
+
+  void reset() {
+    if (!region_)
+      return;
+    region_.reset();
+    on_end_();
+  }
+
+ private:
+  Region region_;
+  OnEnd on_end_;
+};
+
+template <typename Cont>
+auto body_capacity(const Cont& cont, int) -> decltype(cont.capacity()) {
+  return cont.capacity();
+}
+
+template <typename Cont>
+std::size_t body_capacity(const Cont&, long) {
+  return 0;
+}
+
+// body == body and body < body, with memcmp for contiguous bodies of
+// trivially comparable elements
+template <typename Cont>
+bool body_equal(const Cont& lhs, const Cont& rhs, std::false_type) {
+  return lhs == rhs;
+}
+
+template <typename Cont>
+bool body_equal(const Cont& lhs, const Cont& rhs, std::true_type) {
+  return lhs.size() == rhs.size() &&
+         (lhs.data() == rhs.data() || lhs.empty() ||
+          std::memcmp(lhs.data(), rhs.data(),
+                      lhs.size() * sizeof(*lhs.data())) == 0);
+}
+
+template <typename Cont>
+bool body_less(const Cont& lhs, const Cont& rhs, std::false_type) {
+  return lhs < rhs;
+}
+
+// memcmp doesn't order multibyte integers, so it only skips the equal
+// prefix, block by block
+template <typename Cont>
+bool body_less(const Cont& lhs, const Cont& rhs, std::true_type) {
+  if (lhs.data() == rhs.data() && lhs.size() == rhs.size())
+    return false;
+  const std::size_t block = 16;
+  std::size_t common = std::min(lhs.size(), rhs.size());
+  std::size_t i = 0;
+  while (i + block <= common &&
+         std::memcmp(lhs.data() + i, rhs.data() + i,
+                     block * sizeof(*lhs.data())) == 0)
+    i += block;
+  return std::lexicographical_compare(lhs.begin() + i, lhs.end(),
+                                      rhs.begin() + i, rhs.end());
+}
+
+template <typename Traits, class UnderlyingType, class Stats = no_stats>
+class flat_sorted_container_base : private Traits, private Stats {
   using traits = Traits;
 
+  // comparisons are counted only with stats enabled
   struct traits_compare {
-    explicit traits_compare(traits tr) : tr_(tr) {}
+    traits_compare(traits tr, std::size_t* comparisons)
+        : tr_(tr), comparisons_(comparisons) {}
 
     template <typename Lhs, typename Rhs>
     bool operator()(const Lhs& lhs, const Rhs& rhs) {
+      if (Stats::enabled && comparisons_)
+        ++*comparisons_;
       return tr_.cmp(lhs, rhs);
     }
 
    private:
     traits tr_;
+    std::size_t* comparisons_;
   };
 
-  traits_compare traits_comp() const { return traits_compare(*this); }
+  traits_compare traits_comp(std::size_t* comparisons = nullptr) const {
+    return traits_compare(*this, comparisons);
+  }
+
+  // runs search(comp) and reports it's comparisons as one lookup
+  template <typename Search>
+  auto lookup(Search search) const -> decltype(search(traits_comp())) {
+    std::size_t comparisons = 0;
+    auto res = search(traits_comp(&comparisons));
+    Stats::on_lookup(comparisons);
+    return res;
+  }
+
+  using relocatable_body = std::integral_constant<
+      bool,
+      is_contiguous_container<UnderlyingType>::value &&
+          is_trivially_relocatable<typename Traits::value_type>::value>;
+
+  using comparable_body = std::integral_constant<
+      bool,
+      is_contiguous_container<UnderlyingType>::value &&
+          is_trivially_comparable<typename Traits::value_type>::value>;
 
  public:
   using compare = Traits;
@@ -91,12 +375,18 @@ class flat_sorted_container_base : private Traits {
   using const_reverse_iterator =
       typename underlying_type::const_reverse_iterator;
 
+  using stats_type = Stats;
+
   // scoped object to do operations on body, without keeping order
   using unsafe_region =
-      std::unique_ptr<underlying_type, sort_and_unique<traits>>;
+      std::unique_ptr<underlying_type, sort_and_unique<traits, Stats>>;
 
   flat_sorted_container_base() = default;
 
+  // empty container with a stateful comparator
+  explicit flat_sorted_container_base(const key_compare& comp)
+      : Traits(comp) {}
+
   explicit flat_sorted_container_base(underlying_type body)
       : body_(std::move(body)) {
     unsafe_access();
@@ -108,6 +398,16 @@ class flat_sorted_container_base : private Traits {
     unsafe_access();
   }
 
+  // body must be sorted and unique, checked only by assert
+  flat_sorted_container_base(sorted_unique_t, underlying_type body)
+      : body_(std::move(body)) {
+    assert(std::adjacent_find(body_.begin(), body_.end(),
+                              [this](const value_type& lhs,
+                                     const value_type& rhs) {
+                                return !Traits::cmp(lhs, rhs);
+                              }) == body_.end());
+  }
+
   // methods-------------------------------------------------------------------
 
   // returns scoped object, that gives access to underlying storrage.
@@ -115,7 +415,13 @@ class flat_sorted_container_base : private Traits {
   //
   // if you know, that on exit of the region, storrage is already sorted and
   // unified - call unsafe_region::release()
-  unsafe_region unsafe_access() { return {&body_, *this}; }
+  unsafe_region unsafe_access() {
+    return {&body_, sort_and_unique<traits, Stats>(*this, stats())};
+  }
+
+  // counters of the stats policy, see flat_container_stats.h
+  const stats_type& stats() const { return *this; }
+  stats_type& stats() { return *this; }
 
   // get_allocator()
 
@@ -141,98 +447,216 @@ class flat_sorted_container_base : private Traits {
 
   void clear() { body_.clear(); }
 
-  std::pair<iterator, bool> insert(value_type value) {
-    auto pos = lower_bound(key_value_comp().key_from_value(value));
-    if (pos != end() && Traits::equal(*pos, value))
-      return std::make_pair(pos, false);
-    return std::make_pair(body_.insert(pos, std::move(value)), true);
+  std::pair<iterator, bool> insert(const value_type& value) {
+    return emplace(value);
+  }
+
+  std::pair<iterator, bool> insert(value_type&& value) {
+    return emplace(std::move(value));
+  }
+
+  iterator insert(const_iterator hint, const value_type& value) {
+    return emplace_hint(hint, value);
   }
 
-  iterator insert(const_iterator hint, value_type value) {
-    // todo(dyaroshev) use hint
-    return insert(std::move(value)).first;
+  iterator insert(const_iterator hint, value_type&& value) {
+    return emplace_hint(hint, std::move(value));
   }
 
   template <class InputIt>
   void insert(InputIt first, InputIt last) {
+    stats_scope<Stats> scope(stats(), stats_op::insert_range);
+    auto old_size = body_.size();
+    auto old_capacity = Stats::enabled ? body_capacity(body_, 0) : 0;
+
     auto tail = body_.insert(body_.end(), first, last);
+    if (Stats::enabled) {
+      if (body_capacity(body_, 0) != old_capacity)
+        Stats::on_reallocation();
+      Stats::on_sort(static_cast<std::size_t>(std::distance(tail, end())));
+    }
     traits::sort_range(tail, body_.end());
+
+    // merge moves everything after the place of the smallest new element
+    auto merge_from =
+        Stats::enabled && tail != end()
+            ? std::upper_bound(body_.begin(), tail, *tail, traits_comp())
+            : tail;
+    auto moved = static_cast<std::size_t>(std::distance(merge_from, end()));
+
     std::inplace_merge(body_.begin(), tail, body_.end(), traits_comp());
     traits::erase_non_unique(body_);
+    Stats::on_insert(body_.size() - old_size, moved);
   }
 
   // void insert( std::initializer_list<value_type> ilist );
 
+  // if the key can be taken from arguments as is, value_type is constructed
+  // only when the key is not yet in the container.
   template <class... Args>
   std::pair<iterator, bool> emplace(Args&&... args) {  // NOLINT
-    // todo(dyaroshev) reverse - use emplace for insert
-    return insert(value_type(std::forward<Args>(args)...));  // NOLINT
+    stats_scope<Stats> scope(stats(), stats_op::insert);
+    using extractor = key_extractor<key_type, value_type, Args...>;
+    return emplace_impl(std::integral_constant<bool, extractor::value>{},
+                        std::forward<Args>(args)...);
   }
 
+  // if the new element goes right before hint, it's inserted without a
+  // lookup, otherwise it's the same as emplace
   template <class... Args>
   iterator emplace_hint(const_iterator hint, Args&&... args) {  // NOLINT
-    // todo(dyaroshev) reverse - use emplace for insert
-    return insert(hint, value_type(std::forward<Args>(args)...));  // NOLINT
+    stats_scope<Stats> scope(stats(), stats_op::insert);
+    using extractor = key_extractor<key_type, value_type, Args...>;
+    return emplace_hint_impl(std::integral_constant<bool, extractor::value>{},
+                             hint, std::forward<Args>(args)...);
   }
 
   iterator erase(const_iterator position) {
     assert(position != cend());
-    return body_.erase(position);
+    stats_scope<Stats> scope(stats(), stats_op::erase);
+    return erase_at(position);
   }
   void erase(const_iterator first, const_iterator last) {
+    stats_scope<Stats> scope(stats(), stats_op::erase);
+    if (std::distance(first, last) == 1) {
+      erase_at(first);
+      return;
+    }
+    Stats::on_erase(static_cast<std::size_t>(std::distance(first, last)),
+                    static_cast<std::size_t>(std::distance(last, cend())));
     body_.erase(first, last);
   }
 
   size_type erase(const key_type& key) {
-    auto range = equal_range(key);
-    auto res = static_cast<size_type>(std::distance(range.first, range.second));
-    erase(range.first, range.second);
+    stats_scope<Stats> scope(stats(), stats_op::erase);
+    auto found = lower_bound_equal(key);
+    if (!found.second)
+      return 0;
+    erase_at(found.first);
+    return 1;
+  }
+
+  // erases all elements with keys from sorted range [first, last)
+  // in one pass over the body.
+  template <class InputIt>
+  size_type erase_keys(InputIt first, InputIt last) {
+    stats_scope<Stats> scope(stats(), stats_op::erase_bulk);
+    if (first == last)
+      return 0;
+    iterator it = lower_bound_impl(*first);
+    iterator out = it;
+    std::size_t moved = 0;
+    for (; it != end() && first != last; ++it) {
+      while (first != last && Traits::cmp(*first, *it))
+        ++first;
+      if (first != last && !Traits::cmp(*it, *first))
+        continue;
+      if (out != it) {
+        *out = std::move(*it);
+        ++moved;
+      }
+      ++out;
+    }
+    if (out == it)
+      return 0;
+    moved += static_cast<std::size_t>(std::distance(it, end()));
+    out = std::move(it, end(), out);
+    auto res = static_cast<size_type>(std::distance(out, end()));
+    body_.erase(out, body_.end());
+    Stats::on_erase(res, moved);
     return res;
   }
 
   void swap(flat_sorted_container_base& other) { body_.swap(other.body_); }
 
   size_type count(const key_type& key) const {
-    auto range = equal_range(key);
-    return static_cast<size_type>(std::distance(range.first, range.second));
+    stats_scope<Stats> scope(stats(), stats_op::count);
+    return lower_bound_equal(key).second ? 1 : 0;
   }
 
   iterator find(const key_type& key) {
-    auto pos = lower_bound(key);
-    if (pos == end() || !Traits::equal(*pos, key))
-      return end();
-    return pos;
+    stats_scope<Stats> scope(stats(), stats_op::find);
+    auto found = lower_bound_equal(key);
+    return found.second ? found.first : end();
   }
   const_iterator find(const key_type& key) const {
-    auto pos = lower_bound(key);
-    if (pos == end() || !Traits::equal(*pos, key))
-      return end();
-    return pos;
+    stats_scope<Stats> scope(stats(), stats_op::find);
+    auto found = lower_bound_equal(key);
+    return found.second ? found.first : end();
   }
 
   std::pair<iterator, iterator> equal_range(const key_type& key) {
-    return std::equal_range(body_.begin(), body_.end(), key, traits_comp());
+    stats_scope<Stats> scope(stats(), stats_op::equal_range);
+    return lookup([&](traits_compare comp) {
+      return std::equal_range(body_.begin(), body_.end(), key, comp);
+    });
   }
 
   std::pair<const_iterator, const_iterator> equal_range(
       const key_type& key) const {
-    return std::equal_range(body_.begin(), body_.end(), key, traits_comp());
+    stats_scope<Stats> scope(stats(), stats_op::equal_range);
+    return lookup([&](traits_compare comp) {
+      return std::equal_range(body_.begin(), body_.end(), key, comp);
+    });
   }
 
   iterator lower_bound(const key_type& key) {
-    return std::lower_bound(body_.begin(), body_.end(), key, traits_comp());
+    stats_scope<Stats> scope(stats(), stats_op::lower_bound);
+    return lower_bound_impl(key);
   }
 
   const_iterator lower_bound(const key_type& key) const {
-    return std::lower_bound(body_.begin(), body_.end(), key, traits_comp());
+    stats_scope<Stats> scope(stats(), stats_op::lower_bound);
+    return lookup([&](traits_compare comp) {
+      return std::lower_bound(body_.begin(), body_.end(), key, comp);
+    });
   }
 
   iterator upper_bound(const key_type& key) {
-    return std::upper_bound(body_.begin(), body_.end(), key, traits_comp());
+    stats_scope<Stats> scope(stats(), stats_op::upper_bound);
+    return lookup([&](traits_compare comp) {
+      return std::upper_bound(body_.begin(), body_.end(), key, comp);
+    });
   }
 
   const_iterator upper_bound(const key_type& key) const {
-    return std::upper_bound(body_.begin(), body_.end(), key, traits_comp());
+    stats_scope<Stats> scope(stats(), stats_op::upper_bound);
+    return lookup([&](traits_compare comp) {
+      return std::upper_bound(body_.begin(), body_.end(), key, comp);
+    });
+  }
+
+  // same as lower_bound/find, but the search starts at from and gallops
+  // forward: O(log d) comparisons, where d is the distance to the result.
+  // Elements before from must be less than the key.
+  //
+  // non const begin() may detach a shared body (cow_vector), so the index
+  // is taken from the body of from first.
+  iterator lower_bound_from(const_iterator from, const key_type& key) {
+    stats_scope<Stats> scope(stats(), stats_op::lower_bound);
+    auto idx = std::distance(cbegin(), gallop(from, key));
+    return begin() + idx;
+  }
+
+  const_iterator lower_bound_from(const_iterator from,
+                                  const key_type& key) const {
+    stats_scope<Stats> scope(stats(), stats_op::lower_bound);
+    return gallop(from, key);
+  }
+
+  iterator find_from(const_iterator from, const key_type& key) {
+    stats_scope<Stats> scope(stats(), stats_op::find);
+    auto pos = gallop(from, key);
+    if (pos == cend() || Traits::cmp(key, *pos))
+      return end();
+    auto idx = std::distance(cbegin(), pos);
+    return begin() + idx;
+  }
+
+  const_iterator find_from(const_iterator from, const key_type& key) const {
+    stats_scope<Stats> scope(stats(), stats_op::find);
+    auto pos = gallop(from, key);
+    return pos != cend() && !Traits::cmp(key, *pos) ? pos : cend();
   }
 
   key_compare key_comp() const { return traits(*this); }
@@ -241,6 +665,10 @@ class flat_sorted_container_base : private Traits {
 
   key_value_compare key_value_comp() const { return traits(*this); }
 
+  // contiguous bodies of trivially comparable elements, memcmp-ed and hashed
+  // as bytes
+  static constexpr bool trivially_comparable = comparable_body::value;
+
   // regular-------------------------------------------------------------------
   // std::map defines it's comparators based on full value compares,
   // not provided cmps, so equvalent maps are not removed from sets, for example
@@ -252,7 +680,7 @@ class flat_sorted_container_base : private Traits {
 
   friend bool operator==(const flat_sorted_container_base& lhs,
                          const flat_sorted_container_base& rhs) {
-    return lhs.body_ == rhs.body_;
+    return body_equal(lhs.body_, rhs.body_, comparable_body{});
   }
 
   friend bool operator!=(const flat_sorted_container_base& lhs,
@@ -264,7 +692,7 @@ class flat_sorted_container_base : private Traits {
 
   friend bool operator<(const flat_sorted_container_base& lhs,
                         const flat_sorted_container_base& rhs) {
-    return lhs.body_ < rhs.body_;
+    return body_less(lhs.body_, rhs.body_, comparable_body{});
   }
 
   friend bool operator<=(const flat_sorted_container_base& lhs,
@@ -282,12 +710,346 @@ class flat_sorted_container_base : private Traits {
     return !(lhs < rhs);
   }
 
+ protected:
+  // lower_bound and whether it points to an element, equivalent to key.
+  // If traits support three way comparison, does one comparison per probe.
+  std::pair<iterator, bool> lower_bound_equal(const key_type& key) {
+    std::size_t comparisons = 0;
+    auto res = lower_bound_equal(body_.begin(), body_.end(), key, comparisons,
+                                 has_three_way<Traits>{});
+    Stats::on_lookup(comparisons);
+    return res;
+  }
+
+  std::pair<const_iterator, bool> lower_bound_equal(
+      const key_type& key) const {
+    std::size_t comparisons = 0;
+    auto res = lower_bound_equal(body_.begin(), body_.end(), key, comparisons,
+                                 has_three_way<Traits>{});
+    Stats::on_lookup(comparisons);
+    return res;
+  }
+
+  // key is greater than the element before hint and less than hint
+  bool fits_before(const_iterator hint, const key_type& key) const {
+    return (hint == cend() || Traits::cmp(key, *hint)) &&
+           (hint == cbegin() || Traits::cmp(*std::prev(hint), key));
+  }
+
+  // single element shifts of the body, do not check order.
+  iterator insert_at(const_iterator pos, value_type&& value) {
+    auto old_capacity = Stats::enabled ? body_capacity(body_, 0) : 0;
+    Stats::on_insert(1, static_cast<std::size_t>(std::distance(pos, cend())));
+    auto res = insert_at(pos, std::move(value), relocatable_body{});
+    if (Stats::enabled && body_capacity(body_, 0) != old_capacity)
+      Stats::on_reallocation();
+    return res;
+  }
+
+  iterator erase_at(const_iterator pos) {
+    Stats::on_erase(1,
+                    static_cast<std::size_t>(std::distance(pos, cend())) - 1);
+    return erase_at(pos, relocatable_body{});
+  }
+
+  // appends [first, last), folds it's equivalent elements in their order
+  // with combine(value_type& acc, value_type&& next), then folds them into
+  // equivalent elements of the body the same way and merges in the rest.
+  // sorted: [first, last) is already sorted and unique.
+  //
+  // If combine throws, appended elements are dropped, but elements, that
+  // were already combined, stay so.
+  template <class InputIt, class Combine>
+  void upsert_range(InputIt first, InputIt last, Combine combine, bool sorted) {
+    stats_scope<Stats> scope(stats(), stats_op::insert_range);
+    auto old_size = body_.size();
+    auto old_capacity = Stats::enabled ? body_capacity(body_, 0) : 0;
+    body_.insert(body_.end(), first, last);
+    if (Stats::enabled && body_capacity(body_, 0) != old_capacity)
+      Stats::on_reallocation();
+    auto tail = [&] { return body_.begin() + old_size; };
+
+    try {
+      if (!sorted) {
+        Stats::on_sort(body_.size() - old_size);
+        std::stable_sort(tail(), body_.end(), traits_comp());
+        body_.erase(fold_equivalent(tail(), body_.end(), combine),
+                    body_.end());
+      }
+
+      std::size_t comparisons = 0;
+      iterator pos = body_.begin();
+      iterator out = tail();
+      for (iterator it = tail(); it != body_.end(); ++it) {
+        pos = std::lower_bound(pos, tail(), *it, traits_comp(&comparisons));
+        if (pos != tail() && !Traits::cmp(*it, *pos)) {
+          combine(*pos, std::move(*it));
+          continue;
+        }
+        if (out != it)
+          *out = std::move(*it);
+        ++out;
+      }
+      Stats::on_lookup(comparisons);
+      body_.erase(out, body_.end());
+    } catch (...) {
+      body_.erase(tail(), body_.end());
+      throw;
+    }
+
+    auto merge_from =
+        Stats::enabled && tail() != end()
+            ? std::upper_bound(body_.begin(), tail(), *tail(), traits_comp())
+            : tail();
+    auto moved = static_cast<std::size_t>(std::distance(merge_from, end()));
+    std::inplace_merge(body_.begin(), tail(), body_.end(), traits_comp());
+    Stats::on_insert(body_.size() - old_size, moved);
+  }
+
  private:
+  // sorted [first, last) -> unique [first, result), equivalent elements are
+  // combined into the first of them
+  template <class Combine>
+  iterator fold_equivalent(iterator first, iterator last, Combine& combine) {
+    if (first == last)
+      return last;
+    iterator out = first;
+    for (iterator it = std::next(first); it != last; ++it) {
+      if (!Traits::cmp(*out, *it))
+        combine(*out, std::move(*it));
+      else if (++out != it)
+        *out = std::move(*it);
+    }
+    return ++out;
+  }
+
+  // exponential probes from + 1, from + 3, from + 7... and then
+  // a binary search in the last step
+  const_iterator gallop(const_iterator from, const key_type& key) const {
+    return lookup([&](traits_compare comp) {
+      auto last = cend();
+      if (from == last || !comp(*from, key))
+        return from;
+      // *from < key
+      size_type step = 1;
+      while (static_cast<size_type>(std::distance(from, last)) > step &&
+             comp(from[step], key)) {
+        from += step;
+        step *= 2;
+      }
+      auto bound = static_cast<size_type>(std::distance(from, last)) > step
+                       ? from + step
+                       : last;
+      return std::lower_bound(from + 1, bound, key, comp);
+    });
+  }
+
+  iterator lower_bound_impl(const key_type& key) {
+    return lookup([&](traits_compare comp) {
+      return std::lower_bound(body_.begin(), body_.end(), key, comp);
+    });
+  }
+
+  template <class... Args>
+  std::pair<iterator, bool> emplace_impl(std::true_type /*key_extractable*/,
+                                         Args&&... args) {
+    using extractor = key_extractor<key_type, value_type, Args...>;
+    auto found = lower_bound_equal(extractor::get(args...));
+    if (found.second)
+      return std::make_pair(found.first, false);
+    return std::make_pair(
+        insert_at(found.first, value_type(std::forward<Args>(args)...)), true);
+  }
+
+  template <class... Args>
+  std::pair<iterator, bool> emplace_impl(std::false_type /*key_extractable*/,
+                                         Args&&... args) {
+    value_type value(std::forward<Args>(args)...);
+    auto found = lower_bound_equal(key_value_comp().key_from_value(value));
+    if (found.second)
+      return std::make_pair(found.first, false);
+    return std::make_pair(insert_at(found.first, std::move(value)), true);
+  }
+
+  template <class... Args>
+  iterator emplace_hint_impl(std::true_type /*key_extractable*/,
+                             const_iterator hint,
+                             Args&&... args) {
+    using extractor = key_extractor<key_type, value_type, Args...>;
+    if (!fits_before(hint, extractor::get(args...)))
+      return emplace_impl(std::true_type{}, std::forward<Args>(args)...).first;
+    return insert_at(hint, value_type(std::forward<Args>(args)...));
+  }
+
+  template <class... Args>
+  iterator emplace_hint_impl(std::false_type /*key_extractable*/,
+                             const_iterator hint,
+                             Args&&... args) {
+    value_type value(std::forward<Args>(args)...);
+    const auto& key = key_value_comp().key_from_value(value);
+    if (fits_before(hint, key))
+      return insert_at(hint, std::move(value));
+    auto found = lower_bound_equal(key);
+    if (found.second)
+      return found.first;
+    return insert_at(found.first, std::move(value));
+  }
+
+  template <typename It>
+  std::pair<It, bool> lower_bound_equal(It first,
+                                        It last,
+                                        const key_type& key,
+                                        std::size_t& comparisons,
+                                        std::false_type /*three_way*/) const {
+    auto pos = std::lower_bound(first, last, key, traits_comp(&comparisons));
+    if (pos == last)
+      return std::make_pair(pos, false);
+    if (Stats::enabled)
+      comparisons += 2;
+    return std::make_pair(pos, Traits::equal(*pos, key));
+  }
+
+  // result is either last or the last probed element, that is not less than
+  // the key, so it's enough to remember, whether that probe was equal.
+  template <typename It>
+  std::pair<It, bool> lower_bound_equal(It first,
+                                        It last,
+                                        const key_type& key,
+                                        std::size_t& comparisons,
+                                        std::true_type /*three_way*/) const {
+    bool equal = false;
+    auto len = std::distance(first, last);
+    while (len > 0) {
+      auto half = len / 2;
+      It middle = std::next(first, half);
+      int res = Traits::three_way(*middle, key);
+      if (Stats::enabled)
+        ++comparisons;
+      if (res < 0) {
+        first = ++middle;
+        len -= half + 1;
+      } else {
+        equal = res == 0;
+        len = half;
+      }
+    }
+    return std::make_pair(first, equal);
+  }
+
+  iterator insert_at(const_iterator pos,
+                     value_type&& value,
+                     std::false_type /*relocatable*/) {
+    return body_.insert(pos, std::move(value));
+  }
+
+  iterator insert_at(const_iterator pos,
+                     value_type&& value,
+                     std::true_type /*relocatable*/) {
+    auto idx = std::distance(cbegin(), pos);
+    body_.emplace_back(std::move(value));
+    rotate_one_relocatable(body_.data() + body_.size() - 1,
+                           body_.data() + idx);
+    return begin() + idx;
+  }
+
+  iterator erase_at(const_iterator pos, std::false_type /*relocatable*/) {
+    return body_.erase(pos);
+  }
+
+  // element is moved to the back and destroyed there
+  iterator erase_at(const_iterator pos, std::true_type /*relocatable*/) {
+    auto idx = std::distance(cbegin(), pos);
+    rotate_one_relocatable(body_.data() + idx,
+                           body_.data() + body_.size() - 1);
+    body_.pop_back();
+    return begin() + idx;
+  }
+
   underlying_type body_;
 };
 
 }  // namespace internal
 
+// remembers a position in a flat container for a series of increasing keys,
+// like a merge join: every seek gallops forward from the previous result.
+template <typename Container>
+class flat_cursor {
+ public:
+  using iterator = decltype(std::declval<Container&>().begin());
+
+  explicit flat_cursor(Container& cont) : cont_(&cont), pos_(cont.begin()) {}
+
+  // the first element, not less than key. keys must not decrease.
+  iterator seek(const typename Container::key_type& key) {
+    pos_ = cont_->lower_bound_from(pos_, key);
+    return pos_;
+  }
+
+  // element with the key or end.
+  iterator find(const typename Container::key_type& key) {
+    auto found = seek(key);
+    return found != cont_->end() && !cont_->key_comp().cmp(key, *found)
+               ? found
+               : cont_->end();
+  }
+
+  iterator position() const { return pos_; }
+  bool done() const { return pos_ == cont_->end(); }
+
+ private:
+  Container* cont_;
+  iterator pos_;
+};
+
+template <typename Container>
+flat_cursor<Container> make_flat_cursor(Container& cont) {
+  return flat_cursor<Container>(cont);
+}
+
+// erases all elements, satisfying pred, in one pass over the body.
+// returns number of erased elements.
+//
+// if pred throws, elements, for which it returned true, are erased, the
+// rest are kept in order.
+template <typename Traits, class UnderlyingType, class Stats, class Predicate>
+typename UnderlyingType::size_type erase_if(
+    internal::flat_sorted_container_base<Traits, UnderlyingType, Stats>& cont,
+    Predicate pred) {
+  internal::stats_scope<Stats> scope(cont.stats(), stats_op::erase_bulk);
+  // order is kept, so the body is never sorted
+  auto guard = cont.unsafe_access();
+  auto& body = *guard;
+  guard.release();
+
+  auto old_size = body.size();
+  auto first = body.begin();
+  auto last = body.end();
+  auto out = first;
+  // pred is called exactly once per element, so the first erased position
+  // is remembered on the way
+  std::size_t first_erased = old_size;
+  try {
+    for (; first != last; ++first) {
+      if (pred(*first)) {
+        if (first_erased == old_size)
+          first_erased = static_cast<std::size_t>(first - body.begin());
+        continue;
+      }
+      if (out != first)
+        *out = std::move(*first);
+      ++out;
+    }
+  } catch (...) {
+    // moved from holes are between out and first
+    body.erase(std::move(first, last, out), last);
+    throw;
+  }
+  body.erase(out, last);
+  auto res = old_size - body.size();
+  cont.stats().on_erase(res, old_size - first_erased - res);
+  return res;
+}
+
 }  // namespace tools
 
 #endif  // TOOLS_FLAT_SORTED_CONTAINER_BASE_H_
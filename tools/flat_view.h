@@ -0,0 +1,131 @@
+#ifndef TOOLS_FLAT_VIEW_H_
+#define TOOLS_FLAT_VIEW_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "flat_map.h"
+#include "flat_set.h"
+
+namespace tools {
+
+// Read only, non owning pointer and size, that can be the body of flat
+// containers: flat_map_view and flat_set_view are flat_map and flat_set over
+// it, so lookups are the same code as for owning containers, with no copies
+// and no allocations.
+//
+// Elements are owned by someone else (a memory mapped file, a buffer from
+// the network, another container) and must outlive the view.
+template <typename T>
+class const_span {
+ public:
+  using value_type = typename std::remove_const<T>::type;
+  using size_type = std::size_t;
+  using difference_type = std::ptrdiff_t;
+  using reference = const value_type&;
+  using const_reference = const value_type&;
+  using pointer = const value_type*;
+  using const_pointer = const value_type*;
+  using iterator = const value_type*;
+  using const_iterator = const value_type*;
+  using reverse_iterator = std::reverse_iterator<const_iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+  const_span() = default;
+
+  const_span(const_pointer data, size_type size) : data_(data), size_(size) {}
+
+  const_span(const_pointer first, const_pointer last)
+      : data_(first), size_(static_cast<size_type>(last - first)) {}
+
+  // any contiguous container: std::vector, std::array, ...
+  template <typename Cont,
+            typename = decltype(std::declval<const Cont&>().data()),
+            typename = decltype(std::declval<const Cont&>().size())>
+  const_span(const Cont& cont)  // NOLINT
+      : data_(cont.data()), size_(cont.size()) {}
+
+  const_pointer data() const { return data_; }
+
+  const_iterator begin() const { return data_; }
+  const_iterator cbegin() const { return data_; }
+  const_iterator end() const { return data_ + size_; }
+  const_iterator cend() const { return data_ + size_; }
+
+  const_reverse_iterator rbegin() const { return reverse_iterator(end()); }
+  const_reverse_iterator crbegin() const { return rbegin(); }
+  const_reverse_iterator rend() const { return reverse_iterator(begin()); }
+  const_reverse_iterator crend() const { return rend(); }
+
+  bool empty() const { return size_ == 0; }
+  size_type size() const { return size_; }
+  size_type max_size() const {
+    return std::numeric_limits<difference_type>::max() / sizeof(value_type);
+  }
+
+  void swap(const_span& other) {
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+  }
+
+  // compares elements, like std::vector
+  friend bool operator==(const const_span& lhs, const const_span& rhs) {
+    return lhs.size() == rhs.size() &&
+           std::equal(lhs.begin(), lhs.end(), rhs.begin());
+  }
+
+  friend bool operator<(const const_span& lhs, const const_span& rhs) {
+    return std::lexicographical_compare(lhs.begin(), lhs.end(), rhs.begin(),
+                                        rhs.end());
+  }
+
+ private:
+  const_pointer data_ = nullptr;
+  size_type size_ = 0;
+};
+
+template <typename T>
+struct is_contiguous_container<const_span<T>> : std::true_type {};
+
+// Views are made from sorted and unique elements:
+//   flat_set_view<int> view(sorted_unique, {data, size});
+//
+// Views give only const access: mutations don't compile, iterators and at()
+// return const elements.
+template <typename Key,
+          typename T,
+          class Compare = std::less<Key>,
+          class Stats = no_stats>
+using flat_map_view =
+    flat_map<Key, T, Compare, const_span<std::pair<Key, T>>, Stats>;
+
+template <typename Key, class Compare = std::less<Key>, class Stats = no_stats>
+using flat_set_view = flat_set<Key, Compare, const_span<Key>, Stats>;
+
+// view of the body of a flat container, valid until it's next mutation
+template <typename Key, typename T, class Compare, class Stats>
+flat_map_view<Key, T, Compare> make_flat_view(
+    const flat_map<Key, T, Compare, std::vector<std::pair<Key, T>>, Stats>&
+        map) {
+  return flat_map_view<Key, T, Compare>(
+      sorted_unique, const_span<std::pair<Key, T>>(
+                         map.empty() ? nullptr : &*map.begin(), map.size()));
+}
+
+template <typename Key, class Compare, class Stats>
+flat_set_view<Key, Compare> make_flat_view(
+    const flat_set<Key, Compare, std::vector<Key>, Stats>& set) {
+  return flat_set_view<Key, Compare>(
+      sorted_unique,
+      const_span<Key>(set.empty() ? nullptr : &*set.begin(), set.size()));
+}
+
+}  // namespace tools
+
+#endif  // TOOLS_FLAT_VIEW_H_
@@ -0,0 +1,167 @@
+#ifndef TOOLS_FROZEN_FLAT_CONTAINER_H_
+#define TOOLS_FROZEN_FLAT_CONTAINER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "blocked_bloom_filter.h"
+#include "flat_map.h"
+#include "flat_set.h"
+#include "perfect_hash.h"
+
+namespace tools {
+
+// Read only flat_map/flat_set with O(1) find/count/at: a perfect hash maps
+// keys to their indexes in the sorted body. Range queries and iteration
+// still use the body.
+//
+// Hash must agree with Compare, as in filtered_flat_set. If the perfect hash
+// can't be built (different keys with the same hash), lookups fall back to
+// binary search.
+//
+// Mutations go through thaw(), that gives the container back and drops the
+// hash.
+template <typename Container,
+          class Hash = std::hash<typename Container::key_type>>
+class frozen_flat_container {
+ public:
+  using container_type = Container;
+  using key_type = typename Container::key_type;
+  using value_type = typename Container::value_type;
+  using size_type = typename Container::size_type;
+  using key_compare = typename Container::key_compare;
+  using const_iterator = typename Container::const_iterator;
+  using iterator = const_iterator;
+
+  frozen_flat_container() = default;
+
+  explicit frozen_flat_container(Container cont) : cont_(std::move(cont)) {
+    build();
+  }
+
+  // the container, the hash is dropped.
+  Container thaw() && {
+    hash_ = perfect_hash();
+    indexes_.clear();
+    return std::move(cont_);
+  }
+
+  const Container& container() const { return cont_; }
+
+  // false, if lookups fall back to binary search
+  bool hashed() const { return !hash_.empty() || cont_.empty(); }
+
+  std::size_t hash_memory_bytes() const {
+    return hash_.memory_bytes() + indexes_.size() * sizeof(std::uint32_t);
+  }
+
+  // iterators and size--------------------------------------------------------
+
+  const_iterator begin() const { return cont_.begin(); }
+  const_iterator end() const { return cont_.end(); }
+  const_iterator cbegin() const { return cont_.cbegin(); }
+  const_iterator cend() const { return cont_.cend(); }
+
+  bool empty() const { return cont_.empty(); }
+  size_type size() const { return cont_.size(); }
+
+  // point lookups, hashed-----------------------------------------------------
+
+  const_iterator find(const key_type& key) const {
+    if (hash_.empty())
+      return cont_.find(key);
+    auto pos = cont_.begin() + indexes_[hash_(hash(key))];
+    auto comp = cont_.key_comp();
+    return comp.cmp(*pos, key) || comp.cmp(key, *pos) ? cont_.end() : pos;
+  }
+
+  size_type count(const key_type& key) const {
+    return find(key) != end() ? 1 : 0;
+  }
+
+  // only for maps
+  template <typename C = Container>
+  const typename C::mapped_type& at(const key_type& key) const {
+    auto pos = find(key);
+    if (pos == end())
+      throw std::out_of_range("frozen_flat_container::at");
+    return pos->second;
+  }
+
+  // range lookups, sorted body------------------------------------------------
+
+  const_iterator lower_bound(const key_type& key) const {
+    return cont_.lower_bound(key);
+  }
+
+  const_iterator upper_bound(const key_type& key) const {
+    return cont_.upper_bound(key);
+  }
+
+  std::pair<const_iterator, const_iterator> equal_range(
+      const key_type& key) const {
+    return cont_.equal_range(key);
+  }
+
+  key_compare key_comp() const { return cont_.key_comp(); }
+
+  // regular-------------------------------------------------------------------
+
+  friend bool operator==(const frozen_flat_container& lhs,
+                         const frozen_flat_container& rhs) {
+    return lhs.cont_ == rhs.cont_;
+  }
+
+  friend bool operator!=(const frozen_flat_container& lhs,
+                         const frozen_flat_container& rhs) {
+    return !(lhs == rhs);
+  }
+
+ private:
+  static std::uint64_t hash(const key_type& key) {
+    return blocked_bloom_filter::mix_hash(Hash()(key));
+  }
+
+  void build() {
+    std::vector<std::uint64_t> hashes;
+    hashes.reserve(cont_.size());
+    auto comp = cont_.key_value_comp();
+    for (const auto& value : cont_)
+      hashes.push_back(hash(comp.key_from_value(value)));
+    if (cont_.size() > UINT32_MAX || !hash_.build(hashes))
+      return;
+    indexes_.resize(hash_.size());
+    for (std::size_t i = 0; i < hashes.size(); ++i)
+      indexes_[hash_(hashes[i])] = static_cast<std::uint32_t>(i);
+  }
+
+  Container cont_;
+  perfect_hash hash_;
+  // slot of the perfect hash -> index in the body
+  std::vector<std::uint32_t> indexes_;
+};
+
+// read only copy of a flat_map/flat_set with O(1) point lookups
+template <typename Container>
+frozen_flat_container<Container> freeze(Container cont) {
+  return frozen_flat_container<Container>(std::move(cont));
+}
+
+template <typename Key,
+          typename T,
+          class Compare = std::less<Key>,
+          class Hash = std::hash<Key>>
+using frozen_flat_map = frozen_flat_container<flat_map<Key, T, Compare>, Hash>;
+
+template <typename Key,
+          class Compare = std::less<Key>,
+          class Hash = std::hash<Key>>
+using frozen_flat_set = frozen_flat_container<flat_set<Key, Compare>, Hash>;
+
+}  // namespace tools
+
+#endif  // TOOLS_FROZEN_FLAT_CONTAINER_H_
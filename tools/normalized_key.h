@@ -0,0 +1,240 @@
+#ifndef TOOLS_NORMALIZED_KEY_H_
+#define TOOLS_NORMALIZED_KEY_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <ostream>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "flat_sorted_container_base.h"
+
+namespace tools {
+
+// Encodes values into byte strings, that compare with memcmp (shorter one
+// first on a tie) in the same order, as values compare with std::less:
+//   bool              - one byte;
+//   unsigned integers - big endian;
+//   signed integers   - big endian with the sign bit flipped;
+//   floating point    - sign bit flipped for positive, all bits for negative
+//                       numbers, -0 is encoded as 0;
+//   strings           - bytes with 0 escaped as 0 0xff, followed by 0 0;
+//   pairs and tuples  - encodings of the fields, one after another.
+// Every encoding is self delimiting, so they can be concatenated.
+//
+// Specialize for your own types with
+//   static void append(std::string& out, const T& value);
+template <typename T, typename = void>
+struct key_normalizer;
+
+namespace internal {
+
+template <typename UInt>
+void append_big_endian(std::string& out, UInt value) {
+  for (int shift = (sizeof(UInt) - 1) * 8; shift >= 0; shift -= 8)
+    out.push_back(static_cast<char>((value >> shift) & 0xff));
+}
+
+}  // namespace internal
+
+template <typename T>
+struct key_normalizer<
+    T,
+    typename std::enable_if<std::is_integral<T>::value &&
+                            !std::is_same<T, bool>::value>::type> {
+  static void append(std::string& out, T value) {
+    using unsigned_type = typename std::make_unsigned<T>::type;
+    auto bits = static_cast<unsigned_type>(value);
+    if (std::is_signed<T>::value)
+      bits ^= unsigned_type(1) << (sizeof(T) * 8 - 1);
+    internal::append_big_endian(out, bits);
+  }
+};
+
+template <typename T>
+struct key_normalizer<
+    T,
+    typename std::enable_if<std::is_floating_point<T>::value &&
+                            std::numeric_limits<T>::is_iec559>::type> {
+  using bits_type = typename std::conditional<sizeof(T) == 4,
+                                              std::uint32_t,
+                                              std::uint64_t>::type;
+  static_assert(sizeof(T) == sizeof(bits_type), "float or double");
+
+  static void append(std::string& out, T value) {
+    if (value == 0)
+      value = 0;
+    bits_type bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    const bits_type sign = bits_type(1) << (sizeof(bits) * 8 - 1);
+    bits = bits & sign ? ~bits : bits | sign;
+    internal::append_big_endian(out, bits);
+  }
+};
+
+template <>
+struct key_normalizer<bool> {
+  static void append(std::string& out, bool value) {
+    out.push_back(value ? '\1' : '\0');
+  }
+};
+
+template <>
+struct key_normalizer<std::string> {
+  static void append(std::string& out, const std::string& value) {
+    out.reserve(out.size() + value.size() + 2);
+    for (char c : value) {
+      out.push_back(c);
+      if (c == '\0')
+        out.push_back(static_cast<char>(0xff));
+    }
+    out.append(2, '\0');
+  }
+};
+
+template <typename First, typename Second>
+struct key_normalizer<std::pair<First, Second>> {
+  static void append(std::string& out, const std::pair<First, Second>& value) {
+    key_normalizer<First>::append(out, value.first);
+    key_normalizer<Second>::append(out, value.second);
+  }
+};
+
+template <typename... Ts>
+struct key_normalizer<std::tuple<Ts...>> {
+  static void append(std::string& out, const std::tuple<Ts...>& value) {
+    append(out, value, std::index_sequence_for<Ts...>{});
+  }
+
+ private:
+  template <std::size_t... Is>
+  static void append(std::string& out,
+                     const std::tuple<Ts...>& value,
+                     std::index_sequence<Is...>) {
+    int expand[] = {
+        0, (key_normalizer<Ts>::append(out, std::get<Is>(value)), 0)...};
+    (void)expand;
+  }
+};
+
+template <typename T>
+std::string normalize_key(const T& value) {
+  std::string res;
+  key_normalizer<T>::append(res, value);
+  return res;
+}
+
+// Key, stored next to it's normalized bytes. As a key of flat containers
+// (flat_map<normalized_key<std::tuple<...>>, T>), every comparison of
+// a search or a sort is a memcmp, instead of a walk over fields of
+// a composite key with a branch per field. Ordering is the same as
+// std::less<Key>.
+//
+// The first 16 bytes are kept in two big endian integers, like in
+// prefixed_string, so most comparisons don't touch the heap; the rest is
+// in a string, that fits the small buffer up to 31 normalized bytes.
+//
+// Lookups with a plain Key normalize it first, normalize probes once, if
+// they are reused.
+template <typename Key>
+class normalized_key {
+ public:
+  normalized_key() : normalized_key(Key()) {}
+
+  normalized_key(Key key) : key_(std::move(key)) {  // NOLINT
+    std::string bytes = normalize_key(key_);
+    auto head = std::min(bytes.size(), sizeof(head_));
+    unsigned char padded[sizeof(head_)] = {};
+    std::memcpy(padded, bytes.data(), head);
+    for (std::size_t i = 0; i < sizeof(padded); ++i)
+      head_[i / 8] = (head_[i / 8] << 8) | padded[i];
+    tail_.assign(bytes, head, std::string::npos);
+  }
+
+  operator const Key&() const { return key_; }  // NOLINT
+
+  const Key& key() const { return key_; }
+
+  // normalized bytes, padded with zeroes to at least 16
+  std::string bytes() const {
+    std::string res;
+    for (std::uint64_t word : head_)
+      internal::append_big_endian(res, word);
+    return res + tail_;
+  }
+
+  // encodings are self delimiting, so zero padding can't make different
+  // keys equal
+  int compare(const normalized_key& rhs) const {
+    for (std::size_t i = 0; i < 2; ++i) {
+      if (head_[i] != rhs.head_[i])
+        return head_[i] < rhs.head_[i] ? -1 : 1;
+    }
+    return tail_.compare(rhs.tail_);
+  }
+
+  friend bool operator==(const normalized_key& lhs,
+                         const normalized_key& rhs) {
+    return lhs.head_[0] == rhs.head_[0] && lhs.head_[1] == rhs.head_[1] &&
+           lhs.tail_ == rhs.tail_;
+  }
+
+  friend bool operator!=(const normalized_key& lhs,
+                         const normalized_key& rhs) {
+    return !(lhs == rhs);
+  }
+
+  friend bool operator<(const normalized_key& lhs, const normalized_key& rhs) {
+    return lhs.compare(rhs) < 0;
+  }
+
+  friend bool operator<=(const normalized_key& lhs,
+                         const normalized_key& rhs) {
+    return !(rhs < lhs);
+  }
+
+  friend bool operator>(const normalized_key& lhs, const normalized_key& rhs) {
+    return rhs < lhs;
+  }
+
+  friend bool operator>=(const normalized_key& lhs,
+                         const normalized_key& rhs) {
+    return !(lhs < rhs);
+  }
+
+ private:
+  std::uint64_t head_[2] = {};
+  std::string tail_;
+  Key key_;
+};
+
+template <typename Key>
+struct three_way_compare<std::less<normalized_key<Key>>, normalized_key<Key>> {
+  static constexpr bool enabled = true;
+
+  int operator()(const normalized_key<Key>& lhs,
+                 const normalized_key<Key>& rhs) const {
+    return lhs.compare(rhs);
+  }
+};
+
+template <typename Key>
+struct three_way_compare<std::greater<normalized_key<Key>>,
+                         normalized_key<Key>> {
+  static constexpr bool enabled = true;
+
+  int operator()(const normalized_key<Key>& lhs,
+                 const normalized_key<Key>& rhs) const {
+    return rhs.compare(lhs);
+  }
+};
+
+}  // namespace tools
+
+#endif  // TOOLS_NORMALIZED_KEY_H_
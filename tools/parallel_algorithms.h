@@ -0,0 +1,260 @@
+#ifndef TOOLS_PARALLEL_ALGORITHMS_H_
+#define TOOLS_PARALLEL_ALGORITHMS_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace tools {
+
+// Parallel reads of flat containers: find_many, parallel_for_each and
+// parallel_reduce. The body is split by position into chunks of `grain`
+// elements (0 - one chunk), that are handed to the threads of a thread_pool.
+//
+// Chunks depend only on sizes and grain, not on the number of threads or
+// timing, so parallel_reduce gives the same result on any pool: chunks are
+// reduced on their own and then combined in order.
+//
+// The container must not be modified while the algorithm runs.
+
+// fixed set of threads, that run one parallel_for at a time.
+// the calling thread works too, so a pool of 1 thread has no workers.
+class thread_pool {
+ public:
+  explicit thread_pool(std::size_t threads = default_threads()) {
+    for (std::size_t i = 1; i < threads; ++i)
+      workers_.emplace_back([this] { work_loop(); });
+  }
+
+  thread_pool(const thread_pool&) = delete;
+  thread_pool& operator=(const thread_pool&) = delete;
+
+  ~thread_pool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto& worker : workers_)
+      worker.join();
+  }
+
+  std::size_t size() const { return workers_.size() + 1; }
+
+  static std::size_t default_threads() {
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  // calls task(i) for i in [0, tasks) and waits for all of them.
+  // the first exception is rethrown, after all tasks are done.
+  void parallel_for(std::size_t tasks,
+                    const std::function<void(std::size_t)>& task) {
+    if (tasks == 0)
+      return;
+    job current(task, tasks);
+    if (workers_.empty() || tasks == 1) {
+      run(current);
+    } else {
+      std::lock_guard<std::mutex> one_job(run_mutex_);
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        job_ = &current;
+        busy_ = workers_.size();
+        ++generation_;
+      }
+      wake_.notify_all();
+      run(current);
+      std::unique_lock<std::mutex> lock(mutex_);
+      finished_.wait(lock, [this] { return busy_ == 0; });
+      job_ = nullptr;
+    }
+    if (current.error)
+      std::rethrow_exception(current.error);
+  }
+
+ private:
+  struct job {
+    job(const std::function<void(std::size_t)>& task, std::size_t tasks)
+        : task(task), tasks(tasks) {}
+
+    const std::function<void(std::size_t)>& task;
+    std::size_t tasks;
+    std::atomic<std::size_t> next{0};
+    std::mutex error_mutex;
+    std::exception_ptr error;
+  };
+
+  static void run(job& current) {
+    for (std::size_t i; (i = current.next++) < current.tasks;) {
+      try {
+        current.task(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(current.error_mutex);
+        if (!current.error)
+          current.error = std::current_exception();
+      }
+    }
+  }
+
+  void work_loop() {
+    std::size_t seen = 0;
+    for (;;) {
+      job* current;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+        if (stop_)
+          return;
+        seen = generation_;
+        current = job_;
+      }
+      run(*current);
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--busy_ == 0)
+        finished_.notify_one();
+    }
+  }
+
+  std::vector<std::thread> workers_;
+  std::mutex run_mutex_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable finished_;
+  std::size_t generation_ = 0;
+  std::size_t busy_ = 0;
+  job* job_ = nullptr;
+  bool stop_ = false;
+};
+
+constexpr std::size_t kDefaultGrain = 16384;
+
+// [first, last) of random access iterators, that splits into equal parts.
+// parts are plain iterator ranges, so they also work with std algorithms
+// and their execution policies.
+template <typename It>
+class split_range {
+ public:
+  using iterator = It;
+
+  split_range(It first, It last) : first_(first), last_(last) {}
+
+  It begin() const { return first_; }
+  It end() const { return last_; }
+  std::size_t size() const {
+    return static_cast<std::size_t>(std::distance(first_, last_));
+  }
+
+  // parts of at most grain elements, in order; grain 0 - the whole range
+  std::size_t parts(std::size_t grain) const {
+    grain = chunk(grain);
+    return (size() + grain - 1) / grain;
+  }
+
+  split_range part(std::size_t i, std::size_t grain) const {
+    grain = chunk(grain);
+    auto from = static_cast<std::ptrdiff_t>(std::min(size(), i * grain));
+    auto to = static_cast<std::ptrdiff_t>(std::min(size(), (i + 1) * grain));
+    return split_range(first_ + from, first_ + to);
+  }
+
+  std::vector<split_range> split(std::size_t grain) const {
+    std::vector<split_range> res;
+    for (std::size_t i = 0; i < parts(grain); ++i)
+      res.push_back(part(i, grain));
+    return res;
+  }
+
+ private:
+  std::size_t chunk(std::size_t grain) const {
+    return grain ? grain : std::max<std::size_t>(size(), 1);
+  }
+
+  It first_;
+  It last_;
+};
+
+template <typename It>
+split_range<It> make_split_range(It first, It last) {
+  return split_range<It>(first, last);
+}
+
+// elements with keys in [first_key, last_key)
+template <typename Cont>
+split_range<typename Cont::const_iterator> key_range(
+    const Cont& cont,
+    const typename Cont::key_type& first_key,
+    const typename Cont::key_type& last_key) {
+  auto first = cont.lower_bound(first_key);
+  auto last = cont.lower_bound(last_key);
+  return split_range<typename Cont::const_iterator>(first,
+                                                    std::max(first, last));
+}
+
+template <typename Cont>
+split_range<typename Cont::const_iterator> key_range(const Cont& cont) {
+  return split_range<typename Cont::const_iterator>(cont.begin(), cont.end());
+}
+
+// find for every key of [first, last), results in the same order.
+// KeyIt is a random access iterator.
+template <typename Cont, typename KeyIt>
+std::vector<typename Cont::const_iterator> find_many(
+    const Cont& cont,
+    KeyIt first,
+    KeyIt last,
+    thread_pool& pool,
+    std::size_t grain = kDefaultGrain) {
+  auto probes = make_split_range(first, last);
+  std::vector<typename Cont::const_iterator> res(probes.size());
+  pool.parallel_for(probes.parts(grain), [&](std::size_t i) {
+    auto part = probes.part(i, grain);
+    auto out = res.begin() + std::distance(first, part.begin());
+    for (const auto& key : part)
+      *out++ = cont.find(key);
+  });
+  return res;
+}
+
+// f(element) for all elements of the range, concurrently
+template <typename It, typename F>
+void parallel_for_each(split_range<It> range,
+                       F f,
+                       thread_pool& pool,
+                       std::size_t grain = kDefaultGrain) {
+  pool.parallel_for(range.parts(grain), [&](std::size_t i) {
+    for (const auto& element : range.part(i, grain))
+      f(element);
+  });
+}
+
+// folds every chunk with reduce(T, element), starting from init, and then
+// combines chunk results in order with combine(T, T). init must be the
+// identity of combine, like for std::reduce.
+template <typename It, typename T, typename Reduce, typename Combine>
+T parallel_reduce(split_range<It> range,
+                  T init,
+                  Reduce reduce,
+                  Combine combine,
+                  thread_pool& pool,
+                  std::size_t grain = kDefaultGrain) {
+  std::vector<T> partial(range.parts(grain), init);
+  pool.parallel_for(partial.size(), [&](std::size_t i) {
+    for (const auto& element : range.part(i, grain))
+      partial[i] = reduce(std::move(partial[i]), element);
+  });
+  for (auto& value : partial)
+    init = combine(std::move(init), std::move(value));
+  return init;
+}
+
+}  // namespace tools
+
+#endif  // TOOLS_PARALLEL_ALGORITHMS_H_
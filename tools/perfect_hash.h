@@ -0,0 +1,126 @@
+#ifndef TOOLS_PERFECT_HASH_H_
+#define TOOLS_PERFECT_HASH_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "blocked_bloom_filter.h"
+
+namespace tools {
+
+// Perfect hash over a set of distinct 64 bit hashes: maps each of them to
+// a different slot in [0, size()). Hash and displace: hashes are split into
+// buckets of ~kBucketSize, for each bucket, biggest first, a pilot is
+// searched, so that all of it's hashes fall into free slots.
+//
+// Almost minimal: there are 1% more slots than keys, with exactly n slots
+// the last buckets need O(n) attempts each to find the last free slots.
+//
+// Hashes, that were not in the set, go to an arbitrary slot, so the caller
+// has to check the key there.
+//
+// Costs 32 / kBucketSize bits per key for pilots.
+class perfect_hash {
+  static constexpr std::size_t kBucketSize = 4;
+  // give up on a bucket after that many pilots, the set is not hashable
+  static constexpr std::uint32_t kMaxPilot = std::uint32_t(1) << 30;
+
+ public:
+  perfect_hash() = default;
+
+  // false if hashes have duplicates, the hash is empty then.
+  bool build(const std::vector<std::uint64_t>& hashes) {
+    pilots_.clear();
+    slots_ = hashes.size() + hashes.size() / 100;
+    if (hashes.empty())
+      return true;
+
+    std::vector<std::pair<std::size_t, std::uint64_t>> by_bucket;
+    by_bucket.reserve(hashes.size());
+    pilots_.resize((hashes.size() + kBucketSize - 1) / kBucketSize);
+    for (std::uint64_t hash : hashes)
+      by_bucket.emplace_back(bucket(hash), hash);
+    std::sort(by_bucket.begin(), by_bucket.end());
+    if (std::adjacent_find(by_bucket.begin(), by_bucket.end()) !=
+        by_bucket.end())
+      return fail();
+
+    // [first, last) ranges of by_bucket, biggest buckets first
+    std::vector<std::pair<std::size_t, std::size_t>> buckets;
+    for (std::size_t first = 0; first != by_bucket.size();) {
+      std::size_t last = first + 1;
+      while (last != by_bucket.size() &&
+             by_bucket[last].first == by_bucket[first].first)
+        ++last;
+      buckets.emplace_back(first, last);
+      first = last;
+    }
+    std::stable_sort(buckets.begin(), buckets.end(),
+                     [](const std::pair<std::size_t, std::size_t>& lhs,
+                        const std::pair<std::size_t, std::size_t>& rhs) {
+                       return lhs.second - lhs.first > rhs.second - rhs.first;
+                     });
+
+    std::vector<bool> taken(slots_);
+    std::vector<std::size_t> positions;
+    for (const auto& range : buckets) {
+      std::uint32_t pilot = 0;
+      for (;; ++pilot) {
+        if (pilot == kMaxPilot)
+          return fail();
+        positions.clear();
+        bool fits = true;
+        for (std::size_t i = range.first; fits && i != range.second; ++i) {
+          auto pos = slot(by_bucket[i].second, pilot);
+          fits = !taken[pos] && std::find(positions.begin(), positions.end(),
+                                          pos) == positions.end();
+          positions.push_back(pos);
+        }
+        if (fits)
+          break;
+      }
+      pilots_[by_bucket[range.first].first] = pilot;
+      for (std::size_t pos : positions)
+        taken[pos] = true;
+    }
+    return true;
+  }
+
+  bool empty() const { return slots_ == 0; }
+  std::size_t size() const { return slots_; }
+
+  std::size_t operator()(std::uint64_t hash) const {
+    return slot(hash, pilots_[bucket(hash)]);
+  }
+
+  std::size_t memory_bytes() const {
+    return pilots_.size() * sizeof(std::uint32_t);
+  }
+
+ private:
+  bool fail() {
+    pilots_.clear();
+    slots_ = 0;
+    return false;
+  }
+
+  std::size_t bucket(std::uint64_t hash) const {
+    return static_cast<std::size_t>((hash >> 32) * pilots_.size() >> 32);
+  }
+
+  std::size_t slot(std::uint64_t hash, std::uint32_t pilot) const {
+    auto mixed =
+        blocked_bloom_filter::mix_hash(hash ^ (pilot * 0x9e3779b97f4a7c15u));
+    return static_cast<std::size_t>(mixed % slots_);
+  }
+
+  std::vector<std::uint32_t> pilots_;
+  std::size_t slots_ = 0;
+};
+
+}  // namespace tools
+
+#endif  // TOOLS_PERFECT_HASH_H_
@@ -0,0 +1,395 @@
+#ifndef TOOLS_PERSISTENT_FLAT_MAP_H_
+#define TOOLS_PERSISTENT_FLAT_MAP_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "flat_map.h"
+
+namespace tools {
+
+// flat_map, split into sorted chunks of at most ChunkSize elements, that are
+// shared between copies. Copy (snapshot()) is O(1): it shares the whole body.
+// A mutation copies the list of chunks, if it is shared, and the one chunk it
+// touches, so versions of a map take memory proportional to their
+// differences.
+//
+// Lookups are the same as in flat_map: a binary search over the chunks and
+// then in one chunk. Elements can't be modified through iterators, use
+// insert_or_assign.
+//
+// Not thread safe between versions, that share chunks, same as cow_vector.
+template <typename Key,
+          typename T,
+          class Compare = std::less<Key>,
+          std::size_t ChunkSize = 64>
+class persistent_flat_map {
+  static_assert(ChunkSize >= 2, "chunks are split in halves");
+
+ public:
+  using chunk_type = flat_map<Key, T, Compare>;
+  using key_type = Key;
+  using mapped_type = T;
+  using value_type = typename chunk_type::value_type;
+  using size_type = typename chunk_type::size_type;
+  using difference_type = typename chunk_type::difference_type;
+  using key_compare = typename chunk_type::key_compare;
+  using const_reference = const value_type&;
+
+ private:
+  using chunk_ptr = std::shared_ptr<chunk_type>;
+
+  // no empty chunks
+  struct body {
+    std::vector<chunk_ptr> chunks;
+    size_type size = 0;
+  };
+
+ public:
+  class const_iterator {
+   public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = persistent_flat_map::value_type;
+    using difference_type = persistent_flat_map::difference_type;
+    using pointer = const value_type*;
+    using reference = const value_type&;
+
+    const_iterator() = default;
+
+    reference operator*() const { return *pos_; }
+    pointer operator->() const { return &*pos_; }
+
+    const_iterator& operator++() {
+      if (++pos_ == chunk().end() && idx_ + 1 != chunks_->size())
+        pos_ = (*chunks_)[++idx_]->begin();
+      return *this;
+    }
+
+    const_iterator operator++(int) {
+      auto res = *this;
+      ++*this;
+      return res;
+    }
+
+    const_iterator& operator--() {
+      if (pos_ == chunk().begin())
+        pos_ = (*chunks_)[--idx_]->end();
+      --pos_;
+      return *this;
+    }
+
+    const_iterator operator--(int) {
+      auto res = *this;
+      --*this;
+      return res;
+    }
+
+    friend bool operator==(const const_iterator& lhs,
+                           const const_iterator& rhs) {
+      return lhs.idx_ == rhs.idx_ && lhs.pos_ == rhs.pos_;
+    }
+
+    friend bool operator!=(const const_iterator& lhs,
+                           const const_iterator& rhs) {
+      return !(lhs == rhs);
+    }
+
+   private:
+    friend class persistent_flat_map;
+
+    using chunk_iterator = typename chunk_type::const_iterator;
+
+    // end is the end of the last chunk, or default constructed for no chunks
+    const_iterator(const std::vector<chunk_ptr>* chunks,
+                   size_type idx,
+                   chunk_iterator pos)
+        : chunks_(chunks), idx_(idx), pos_(pos) {}
+
+    const chunk_type& chunk() const { return *(*chunks_)[idx_]; }
+
+    const std::vector<chunk_ptr>* chunks_ = nullptr;
+    size_type idx_ = 0;
+    chunk_iterator pos_{};
+  };
+
+  using iterator = const_iterator;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+  using reverse_iterator = const_reverse_iterator;
+
+  // ctors---------------------------------------------------------------------
+
+  persistent_flat_map() = default;
+
+  explicit persistent_flat_map(const key_compare& comp) : comp_(comp) {}
+
+  explicit persistent_flat_map(const chunk_type& map)
+      : comp_(map.key_comp()) {
+    assign(map.begin(), map.end());
+  }
+
+  template <typename It>
+  persistent_flat_map(It first,
+                      It last,
+                      const key_compare& comp = key_compare())
+      : comp_(comp) {
+    chunk_type map(comp_);
+    map.insert(first, last);
+    assign(std::make_move_iterator(map.begin()),
+           std::make_move_iterator(map.end()));
+  }
+
+  // immutable version of the map, O(1).
+  persistent_flat_map snapshot() const { return *this; }
+
+  // iterators-----------------------------------------------------------------
+
+  const_iterator begin() const {
+    return empty() ? end() : make_iterator(0, chunks()[0]->begin());
+  }
+  const_iterator cbegin() const { return begin(); }
+
+  const_iterator end() const {
+    return empty() ? const_iterator()
+                   : make_iterator(chunks().size() - 1, chunks().back()->end());
+  }
+  const_iterator cend() const { return end(); }
+
+  const_reverse_iterator rbegin() const {
+    return const_reverse_iterator(end());
+  }
+  const_reverse_iterator crbegin() const { return rbegin(); }
+
+  const_reverse_iterator rend() const {
+    return const_reverse_iterator(begin());
+  }
+  const_reverse_iterator crend() const { return rend(); }
+
+  // size----------------------------------------------------------------------
+
+  bool empty() const { return size() == 0; }
+  size_type size() const { return body_ ? body_->size : 0; }
+
+  size_type chunk_count() const { return body_ ? chunks().size() : 0; }
+
+  // number of chunks, that this version shares with the other one
+  size_type shared_chunks(const persistent_flat_map& other) const {
+    if (!body_ || !other.body_)
+      return 0;
+    std::unordered_set<const chunk_type*> others;
+    for (const auto& chunk : other.chunks())
+      others.insert(chunk.get());
+    size_type res = 0;
+    for (const auto& chunk : chunks())
+      res += others.count(chunk.get());
+    return res;
+  }
+
+  // lookups-------------------------------------------------------------------
+
+  const mapped_type& at(const key_type& key) const {
+    auto pos = find(key);
+    if (pos == end())
+      throw std::out_of_range("persistent_flat_map::at");
+    return pos->second;
+  }
+
+  size_type count(const key_type& key) const {
+    return find(key) != end() ? 1 : 0;
+  }
+
+  const_iterator find(const key_type& key) const {
+    auto idx = chunk_lower_bound(key);
+    if (idx == chunk_count())
+      return end();
+    auto pos = chunks()[idx]->find(key);
+    return pos == chunks()[idx]->end() ? end() : make_iterator(idx, pos);
+  }
+
+  const_iterator lower_bound(const key_type& key) const {
+    auto idx = chunk_lower_bound(key);
+    if (idx == chunk_count())
+      return end();
+    return make_iterator(idx, chunks()[idx]->lower_bound(key));
+  }
+
+  const_iterator upper_bound(const key_type& key) const {
+    auto idx = chunk_upper_bound(key);
+    if (idx == chunk_count())
+      return end();
+    return make_iterator(idx, chunks()[idx]->upper_bound(key));
+  }
+
+  std::pair<const_iterator, const_iterator> equal_range(
+      const key_type& key) const {
+    return {lower_bound(key), upper_bound(key)};
+  }
+
+  key_compare key_comp() const { return comp_; }
+
+  // modifiers-----------------------------------------------------------------
+
+  std::pair<const_iterator, bool> insert(const value_type& value) {
+    return try_emplace(value.first, value.second);
+  }
+
+  template <class... Args>
+  std::pair<const_iterator, bool> try_emplace(const key_type& key,
+                                              Args&&... args) {
+    auto found = find(key);
+    if (found != end())
+      return {found, false};
+    auto idx = insert_chunk(key);
+    mutable_chunk(idx).try_emplace(key, std::forward<Args>(args)...);
+    ++body_->size;
+    split_if_full(idx);
+    return {find(key), true};
+  }
+
+  template <class M>
+  std::pair<const_iterator, bool> insert_or_assign(const key_type& key,
+                                                   M&& obj) {
+    auto found = find(key);
+    if (found == end())
+      return try_emplace(key, std::forward<M>(obj));
+    mutable_chunk(found.idx_).insert_or_assign(key, std::forward<M>(obj));
+    return {find(key), false};
+  }
+
+  size_type erase(const key_type& key) {
+    auto found = find(key);
+    if (found == end())
+      return 0;
+    auto idx = found.idx_;
+    mutable_chunk(idx).erase(key);
+    --body_->size;
+    if (chunks()[idx]->empty())
+      body_->chunks.erase(body_->chunks.begin() + idx);
+    return 1;
+  }
+
+  void clear() { body_.reset(); }
+
+  void swap(persistent_flat_map& other) {
+    using std::swap;
+    body_.swap(other.body_);
+    swap(comp_, other.comp_);
+  }
+
+  // regular-------------------------------------------------------------------
+
+  friend bool operator==(const persistent_flat_map& lhs,
+                         const persistent_flat_map& rhs) {
+    return lhs.size() == rhs.size() &&
+           std::equal(lhs.begin(), lhs.end(), rhs.begin());
+  }
+
+  friend bool operator!=(const persistent_flat_map& lhs,
+                         const persistent_flat_map& rhs) {
+    return !(lhs == rhs);
+  }
+
+  friend void swap(persistent_flat_map& lhs, persistent_flat_map& rhs) {
+    lhs.swap(rhs);
+  }
+
+ private:
+  const std::vector<chunk_ptr>& chunks() const { return body_->chunks; }
+
+  const_iterator make_iterator(size_type idx,
+                               typename chunk_type::const_iterator pos) const {
+    return const_iterator(&chunks(), idx, pos);
+  }
+
+  // first chunk, which last element is not less than the key
+  size_type chunk_lower_bound(const key_type& key) const {
+    if (!body_)
+      return 0;
+    return static_cast<size_type>(
+        std::partition_point(chunks().begin(), chunks().end(),
+                             [&](const chunk_ptr& chunk) {
+                               return comp_.cmp(*chunk->rbegin(), key);
+                             }) -
+        chunks().begin());
+  }
+
+  // first chunk, which last element is greater than the key
+  size_type chunk_upper_bound(const key_type& key) const {
+    if (!body_)
+      return 0;
+    return static_cast<size_type>(
+        std::partition_point(chunks().begin(), chunks().end(),
+                             [&](const chunk_ptr& chunk) {
+                               return !comp_.cmp(key, *chunk->rbegin());
+                             }) -
+        chunks().begin());
+  }
+
+  // keys after the last element go to the last chunk
+  size_type insert_chunk(const key_type& key) {
+    if (empty()) {
+      mutable_body().chunks.push_back(std::make_shared<chunk_type>(comp_));
+      return 0;
+    }
+    return std::min(chunk_lower_bound(key), chunks().size() - 1);
+  }
+
+  body& mutable_body() {
+    if (!body_)
+      body_ = std::make_shared<body>();
+    else if (body_.use_count() > 1)
+      body_ = std::make_shared<body>(*body_);
+    return *body_;
+  }
+
+  chunk_type& mutable_chunk(size_type idx) {
+    auto& chunk = mutable_body().chunks[idx];
+    if (chunk.use_count() > 1)
+      chunk = std::make_shared<chunk_type>(*chunk);
+    return *chunk;
+  }
+
+  void split_if_full(size_type idx) {
+    auto& left = mutable_chunk(idx);
+    if (left.size() <= ChunkSize)
+      return;
+    auto middle = left.begin() + static_cast<difference_type>(left.size() / 2);
+    auto right = std::make_shared<chunk_type>(comp_);
+    {
+      auto guard = right->unsafe_access();
+      guard->assign(std::make_move_iterator(middle),
+                    std::make_move_iterator(left.end()));
+      guard.release();
+    }
+    left.erase(middle, left.end());
+    body_->chunks.insert(body_->chunks.begin() + idx + 1, std::move(right));
+  }
+
+  // [first, last) is sorted and unique
+  template <typename It>
+  void assign(It first, It last) {
+    auto& to = mutable_body();
+    while (first != last) {
+      auto chunk = std::make_shared<chunk_type>(comp_);
+      auto guard = chunk->unsafe_access();
+      for (; first != last && guard->size() < ChunkSize; ++first)
+        guard->push_back(*first);
+      guard.release();
+      to.size += chunk->size();
+      to.chunks.push_back(std::move(chunk));
+    }
+  }
+
+  std::shared_ptr<body> body_;
+  key_compare comp_;
+};
+
+}  // namespace tools
+
+#endif  // TOOLS_PERSISTENT_FLAT_MAP_H_
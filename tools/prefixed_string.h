@@ -0,0 +1,119 @@
+#ifndef TOOLS_PREFIXED_STRING_H_
+#define TOOLS_PREFIXED_STRING_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <utility>
+
+#include "flat_sorted_container_base.h"
+
+namespace tools {
+
+// std::string, that keeps it's first 8 bytes packed in an integer next to it.
+// As a key of flat containers (flat_map<prefixed_string, T>) most comparisons
+// are resolved on the prefix, without touching string's heap buffer.
+// Ordering is the same as for std::string.
+class prefixed_string {
+ public:
+  prefixed_string() = default;
+
+  prefixed_string(std::string str)  // NOLINT
+      : prefix_(make_prefix(str)), str_(std::move(str)) {}
+
+  prefixed_string(const char* str)  // NOLINT
+      : prefixed_string(std::string(str)) {}
+
+  operator const std::string&() const { return str_; }  // NOLINT
+
+  const std::string& str() const { return str_; }
+  const char* c_str() const { return str_.c_str(); }
+  const char* data() const { return str_.data(); }
+  std::size_t size() const { return str_.size(); }
+  bool empty() const { return str_.empty(); }
+
+  std::uint64_t prefix() const { return prefix_; }
+
+  int compare(const prefixed_string& rhs) const {
+    if (prefix_ != rhs.prefix_)
+      return prefix_ < rhs.prefix_ ? -1 : 1;
+    return str_.compare(rhs.str_);
+  }
+
+  friend bool operator==(const prefixed_string& lhs,
+                         const prefixed_string& rhs) {
+    return lhs.prefix_ == rhs.prefix_ && lhs.str_ == rhs.str_;
+  }
+
+  friend bool operator!=(const prefixed_string& lhs,
+                         const prefixed_string& rhs) {
+    return !(lhs == rhs);
+  }
+
+  friend bool operator<(const prefixed_string& lhs,
+                        const prefixed_string& rhs) {
+    if (lhs.prefix_ != rhs.prefix_)
+      return lhs.prefix_ < rhs.prefix_;
+    return lhs.str_ < rhs.str_;
+  }
+
+  friend bool operator<=(const prefixed_string& lhs,
+                         const prefixed_string& rhs) {
+    return !(rhs < lhs);
+  }
+
+  friend bool operator>(const prefixed_string& lhs,
+                        const prefixed_string& rhs) {
+    return rhs < lhs;
+  }
+
+  friend bool operator>=(const prefixed_string& lhs,
+                         const prefixed_string& rhs) {
+    return !(lhs < rhs);
+  }
+
+  friend std::ostream& operator<<(std::ostream& out,
+                                  const prefixed_string& that) {
+    return out << that.str_;
+  }
+
+ private:
+  // big endian, so that integers compare like bytes in memcmp.
+  // shorter strings are padded with zeroes, ties are resolved by str_.
+  static std::uint64_t make_prefix(const std::string& str) {
+    unsigned char bytes[sizeof(std::uint64_t)] = {};
+    std::memcpy(bytes, str.data(), std::min(str.size(), sizeof(bytes)));
+    std::uint64_t res = 0;
+    for (unsigned char byte : bytes)
+      res = (res << 8) | byte;
+    return res;
+  }
+
+  std::uint64_t prefix_ = 0;
+  std::string str_;
+};
+
+template <>
+struct three_way_compare<std::less<prefixed_string>, prefixed_string> {
+  static constexpr bool enabled = true;
+
+  int operator()(const prefixed_string& lhs, const prefixed_string& rhs) const {
+    return lhs.compare(rhs);
+  }
+};
+
+template <>
+struct three_way_compare<std::greater<prefixed_string>, prefixed_string> {
+  static constexpr bool enabled = true;
+
+  int operator()(const prefixed_string& lhs, const prefixed_string& rhs) const {
+    return rhs.compare(lhs);
+  }
+};
+
+}  // namespace tools
+
+#endif  // TOOLS_PREFIXED_STRING_H_
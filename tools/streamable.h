@@ -0,0 +1,202 @@
+#ifndef TOOLS_STREAMABLE_H_
+#define TOOLS_STREAMABLE_H_
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "flat_sorted_container_base.h"
+
+namespace tools {
+
+// Any copyable type with operator<<, with value semantics.
+//
+// Objects up to BufferSize bytes, that can't throw on move, are stored in
+// the wrapper itself, bigger ones on the heap. Instead of a virtual base
+// class, there is one static table of functions per stored type, so moves
+// of heap objects and of trivially relocatable ones are memcpy of the
+// buffer and copies of trivially copyable ones don't allocate.
+//
+// Default constructed or moved from streamable is empty and streams nothing.
+template <std::size_t BufferSize = sizeof(std::string)>
+class basic_streamable {
+  static_assert(BufferSize >= sizeof(void*), "buffer holds a heap pointer");
+
+  using storage_t = typename std::aligned_storage<BufferSize>::type;
+
+ public:
+  static constexpr std::size_t buffer_size = BufferSize;
+
+  template <typename T>
+  static constexpr bool fits_inline() {
+    return sizeof(T) <= BufferSize &&
+           alignof(storage_t) % alignof(T) == 0 &&
+           std::is_nothrow_move_constructible<T>::value;
+  }
+
+  basic_streamable() = default;
+
+  template <typename T,
+            typename U = typename std::decay<T>::type,
+            typename = typename std::enable_if<
+                !std::is_same<U, basic_streamable>::value>::type>
+  basic_streamable(T&& that) {  // NOLINT
+    vtable_ = model<U, fits_inline<U>()>::construct(&storage_,
+                                                    std::forward<T>(that));
+  }
+
+  template <typename T,
+            typename U = typename std::decay<T>::type,
+            typename = typename std::enable_if<
+                !std::is_same<U, basic_streamable>::value>::type>
+  basic_streamable& operator=(T&& that) {
+    basic_streamable tmp(std::forward<T>(that));
+    return *this = std::move(tmp);
+  }
+
+  basic_streamable(const basic_streamable& that) : vtable_(that.vtable_) {
+    if (!vtable_)
+      return;
+    if (vtable_->copy)
+      vtable_->copy(&that.storage_, &storage_);
+    else
+      std::memcpy(&storage_, &that.storage_, sizeof(storage_));
+  }
+
+  basic_streamable(basic_streamable&& that) noexcept {
+    steal(that);
+  }
+
+  basic_streamable& operator=(const basic_streamable& that) {
+    basic_streamable tmp(that);
+    return *this = std::move(tmp);
+  }
+
+  basic_streamable& operator=(basic_streamable&& that) noexcept {
+    if (this != &that) {
+      reset();
+      steal(that);
+    }
+    return *this;
+  }
+
+  ~basic_streamable() { reset(); }
+
+  bool empty() const { return !vtable_; }
+
+  friend std::ostream& operator<<(std::ostream& out,
+                                  const basic_streamable& that) {
+    return that.vtable_ ? that.vtable_->stream(out, &that.storage_) : out;
+  }
+
+ private:
+  // null copy, move and destroy mean memcpy, memcpy and nothing
+  struct vtable_t {
+    std::ostream& (*stream)(std::ostream&, const void* storage);
+    void (*copy)(const void* from, void* to);
+    void (*move)(void* from, void* to) noexcept;
+    void (*destroy)(void* storage) noexcept;
+  };
+
+  template <typename T, bool Inline>
+  struct model;
+
+  // T in the buffer
+  template <typename T>
+  struct model<T, true> {
+    static const T& get(const void* storage) {
+      return *static_cast<const T*>(storage);
+    }
+
+    template <typename Arg>
+    static const vtable_t* construct(void* storage, Arg&& arg) {
+      ::new (storage) T(std::forward<Arg>(arg));
+      return vtable();
+    }
+
+    static std::ostream& stream(std::ostream& out, const void* storage) {
+      return out << get(storage);
+    }
+
+    static void copy(const void* from, void* to) { ::new (to) T(get(from)); }
+
+    static void move(void* from, void* to) noexcept {
+      T& src = *static_cast<T*>(from);
+      ::new (to) T(std::move(src));
+      src.~T();
+    }
+
+    static void destroy(void* storage) noexcept {
+      static_cast<T*>(storage)->~T();
+    }
+
+    static const vtable_t* vtable() {
+      static const vtable_t res = {
+          &stream,
+          std::is_trivially_copyable<T>::value ? nullptr : &copy,
+          is_trivially_relocatable<T>::value ? nullptr : &move,
+          std::is_trivially_destructible<T>::value ? nullptr : &destroy};
+      return &res;
+    }
+  };
+
+  // pointer to T in the buffer
+  template <typename T>
+  struct model<T, false> {
+    static T*& get(void* storage) { return *static_cast<T**>(storage); }
+
+    static const T& get(const void* storage) {
+      return **static_cast<T* const*>(storage);
+    }
+
+    template <typename Arg>
+    static const vtable_t* construct(void* storage, Arg&& arg) {
+      get(storage) = new T(std::forward<Arg>(arg));
+      return vtable();
+    }
+
+    static std::ostream& stream(std::ostream& out, const void* storage) {
+      return out << get(storage);
+    }
+
+    static void copy(const void* from, void* to) { get(to) = new T(get(from)); }
+
+    static void destroy(void* storage) noexcept { delete get(storage); }
+
+    static const vtable_t* vtable() {
+      static const vtable_t res = {&stream, &copy, nullptr, &destroy};
+      return &res;
+    }
+  };
+
+  // that becomes empty
+  void steal(basic_streamable& that) noexcept {
+    vtable_ = that.vtable_;
+    if (!vtable_)
+      return;
+    if (vtable_->move)
+      vtable_->move(&that.storage_, &storage_);
+    else
+      std::memcpy(&storage_, &that.storage_, sizeof(storage_));
+    that.vtable_ = nullptr;
+  }
+
+  void reset() noexcept {
+    if (vtable_ && vtable_->destroy)
+      vtable_->destroy(&storage_);
+    vtable_ = nullptr;
+  }
+
+  const vtable_t* vtable_ = nullptr;
+  storage_t storage_;
+};
+
+using streamable = basic_streamable<>;
+
+}  // namespace tools
+
+#endif  // TOOLS_STREAMABLE_H_
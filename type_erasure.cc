@@ -1,62 +1,14 @@
+#include "tools/streamable.h"
+#include "tools/streamable_collection.h"
+
 #include <algorithm>
 #include <iostream>
 #include <iterator>
-#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
-class streamable {
- public:
-  template <typename T>
-  streamable(T that)
-      : body_{new obj_t<T>(that)} {};
-  template <typename T>
-  streamable& operator=(T that) {
-    streamable tmp(that);
-    return *this = std::move(tmp);
-  }
-
-  // defining default constructor depends on style
-  streamable() = default;
-  streamable(const streamable& that) : body_(that.body_->clone()) {}
-  streamable(streamable&&) = default;
-  streamable& operator=(const streamable& that) {
-    auto tmp = that;
-    return *this = std::move(tmp);
-  }
-  streamable& operator=(streamable&&) = default;
-
-  friend std::ostream& operator<<(std::ostream& out, const streamable& that) {
-    return that.body_->stream(out);
-  }
-
- private:
-  struct concept_t {
-    virtual std::ostream& stream(std::ostream& stream) const = 0;
-    virtual std::unique_ptr<concept_t> clone() const = 0;
-    virtual ~concept_t() {}
-  };
-
-  template <typename T>
-  class obj_t : public concept_t {
-   public:
-    obj_t(T that) : body_{std::move(that)} {}
-
-    std::ostream& stream(std::ostream& stream) const final {
-      return stream << body_;
-    }
-
-    std::unique_ptr<concept_t> clone() const final {
-      return std::unique_ptr<concept_t>{new obj_t{body_}};
-    }
-
-   private:
-    T body_;
-  };
-
-  std::unique_ptr<concept_t> body_;
-};
+using tools::streamable;
 
 int main() {
   std::vector<streamable> test{1, 8u, std::string("abc")};
@@ -67,4 +19,14 @@ int main() {
   std::copy(test.begin(), test.end(),
             std::ostream_iterator<streamable>(std::cout, " "));
   std::cout << std::endl;
+
+  // the same values, grouped by type: one virtual call per type
+  tools::streamable_collection grouped;
+  grouped.insert(1);
+  grouped.insert(8u);
+  grouped.insert(std::string("abc"));
+  grouped.insert(std::string("ddd"));
+  auto grouped_copy = grouped;                   // copyable
+  auto grouped_copy2 = std::move(grouped_copy);  // movable
+  grouped.stream(std::cout, " ") << std::endl;
 }
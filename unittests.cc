@@ -1,13 +1,38 @@
 // Copyright (c) 2016 Yandex. All rights reserved.
 // Author: Denis Yaroshevskiy <dyaroshev@yandex-team.ru>
 
+#include "tools/compressed_flat_set.h"
+#include "tools/cow_vector.h"
+#include "tools/filtered_flat_set.h"
+#include "tools/flat_container_hash.h"
 #include "tools/flat_map.h"
 #include "tools/flat_set.h"
+#include "tools/flat_view.h"
+#include "tools/frozen_flat_container.h"
+#include "tools/normalized_key.h"
+#include "tools/parallel_algorithms.h"
+#include "tools/persistent_flat_map.h"
+#include "tools/prefixed_string.h"
+#include "tools/streamable.h"
+#include "tools/streamable_collection.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
 #include <iterator>
+#include <limits>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace {
 
@@ -15,6 +40,10 @@ std::string Serialize(const std::string& that) {
   return that;
 }
 
+std::string Serialize(const tools::prefixed_string& that) {
+  return that.str();
+}
+
 std::string Serialize(int that) {
   return std::to_string(that);
 }
@@ -142,6 +171,24 @@ struct FlatMapTest
   void RegularTypeAndConstructors();
   void Getters();
   void Erasers();
+  void Relocation();
+  void ThreeWayCompare();
+  void PrefixedStringKeys();
+  void TryEmplace();
+  void Stats();
+  void Galloping();
+  void Persistent();
+  void Filtered();
+  void Frozen();
+  void Compressed();
+  void Parallel();
+  void Views();
+  void Streamable();
+  void StreamableCollection();
+  void Upsert();
+  void CopyOnWrite();
+  void NormalizedKeys();
+  void Hashing();
 };
 
 std::vector<RegularFlatSet::value_type> RegularKeys() {
@@ -563,6 +610,83 @@ void erasers_test(const KeyValuePairs& key_value_pairs, const Keys& keys) {
           << prefix << ExpectedActualMsg(test_cont, fl_cont);
     }
   }
+  {
+    const char prefix[] = "size_type erase_keys(first, last) ";
+    std::vector<typename FlatCont::key_type> sorted_keys(keys.begin(),
+                                                         keys.end());
+    auto comp = FlatCont().key_comp();
+    std::sort(sorted_keys.begin(), sorted_keys.end(),
+              [&comp](const typename FlatCont::key_type& lhs,
+                      const typename FlatCont::key_type& rhs) {
+                return comp.cmp(lhs, rhs);
+              });
+    for (std::size_t step = 1; step <= 3; ++step) {
+      for (std::size_t from = 0; from < step; ++from) {
+        FlatCont fl_cont(key_value_pairs.begin(), key_value_pairs.end());
+        StdCont test_cont(key_value_pairs.begin(), key_value_pairs.end());
+        std::vector<typename FlatCont::key_type> to_erase;
+        typename FlatCont::size_type erased = 0;
+        for (std::size_t i = from; i < sorted_keys.size(); i += step) {
+          to_erase.push_back(sorted_keys[i]);
+          erased += test_cont.erase(sorted_keys[i]);
+        }
+        EXPECT_EQ(fl_cont.erase_keys(to_erase.begin(), to_erase.end()), erased)
+            << prefix;
+        EXPECT_TRUE(check_map(fl_cont, test_cont))
+            << prefix << ExpectedActualMsg(test_cont, fl_cont);
+      }
+    }
+  }
+  {
+    const char prefix[] = "size_type erase_if(cont, pred) ";
+    FlatCont fl_cont(key_value_pairs.begin(), key_value_pairs.end());
+    StdCont test_cont(key_value_pairs.begin(), key_value_pairs.end());
+    std::size_t idx = 0;
+    auto every_other = [&idx](const typename FlatCont::value_type&) {
+      return idx++ % 2 == 0;
+    };
+    typename FlatCont::size_type erased = 0;
+    for (auto it = test_cont.begin(); it != test_cont.end();) {
+      if (every_other(*it)) {
+        it = test_cont.erase(it);
+        ++erased;
+      } else {
+        ++it;
+      }
+    }
+    idx = 0;
+    EXPECT_EQ(tools::erase_if(fl_cont, every_other), erased) << prefix;
+    EXPECT_TRUE(check_map(fl_cont, test_cont))
+        << prefix << ExpectedActualMsg(test_cont, fl_cont);
+  }
+  {
+    const char prefix[] = "erase_if(cont, pred), pred throws ";
+    FlatCont fl_cont(key_value_pairs.begin(), key_value_pairs.end());
+    const std::size_t throw_at = fl_cont.size() / 2;
+    std::vector<typename FlatCont::value_type> expected;
+    std::size_t idx = 0;
+    for (const auto& value : fl_cont) {
+      if (idx >= throw_at || idx % 2 != 0)
+        expected.push_back(value);
+      ++idx;
+    }
+    idx = 0;
+    auto throws_halfway = [&idx,
+                           throw_at](const typename FlatCont::value_type&) {
+      if (idx == throw_at)
+        throw std::runtime_error("pred");
+      return idx++ % 2 == 0;
+    };
+    bool thrown = false;
+    try {
+      tools::erase_if(fl_cont, throws_halfway);
+    } catch (const std::runtime_error&) {
+      thrown = true;
+    }
+    EXPECT_TRUE(thrown) << prefix;
+    EXPECT_TRUE(check_map(fl_cont, expected))
+        << prefix << ExpectedActualMsg(expected, fl_cont);
+  }
   //  erase with iterators works like in underlying type, not in a map
   {
     const char prefix[] = "it erase (const_it) ";
@@ -614,10 +738,1368 @@ void FlatMapTest::Erasers() {
   erasers_test<FlatSet, StdSet>(keys, keys_with_one_extra);
 }
 
+namespace {
+
+// owns heap memory, but can be moved with memcpy
+struct BoxedInt {
+  explicit BoxedInt(int value) : body(new int(value)) {}
+  friend bool operator<(const BoxedInt& lhs, const BoxedInt& rhs) {
+    return *lhs.body < *rhs.body;
+  }
+  std::unique_ptr<int> body;
+};
+
+}  // namespace
+
+namespace tools {
+
+template <>
+struct is_trivially_relocatable<BoxedInt> : std::true_type {};
+
+}  // namespace tools
+
+void FlatMapTest::Relocation() {
+  using FlatMap = tools::flat_map<int, int>;
+  using StdMap = FlatMap::std_map;
+  using FlatSet = tools::flat_set<BoxedInt>;
+
+  std::vector<FlatMap::value_type> key_value_pairs;
+  std::vector<int> keys;
+  for (const auto& kv_pair : RegularKeyValuePairs()) {
+    key_value_pairs.emplace_back(static_cast<int>(kv_pair.first.size()) * 100 +
+                                     kv_pair.first[0],
+                                 kv_pair.second);
+    keys.push_back(key_value_pairs.back().first);
+  }
+  keys.push_back(-1);
+
+  {
+    const char prefix[] = "relocatable operator[], insert ";
+    FlatMap fl_map;
+    StdMap test_map;
+    for (const auto& test_case : key_value_pairs) {
+      fl_map[test_case.first] += test_case.second;
+      test_map[test_case.first] += test_case.second;
+      EXPECT_TRUE(check_map(fl_map, test_map))
+          << prefix << ExpectedActualMsg(test_map, fl_map);
+    }
+  }
+  insert_test<FlatMap, StdMap>(key_value_pairs);
+  erasers_test<FlatMap, StdMap>(key_value_pairs, keys);
+
+  {
+    const char prefix[] = "relocatable owning type ";
+    FlatSet fl_set;
+    std::vector<int> test_set;
+    for (int value : {5, 3, 8, 1, 9, 4, 3}) {
+      fl_set.insert(BoxedInt(value));
+      auto pos = std::lower_bound(test_set.begin(), test_set.end(), value);
+      if (pos == test_set.end() || *pos != value)
+        test_set.insert(pos, value);
+    }
+    for (int value : {4, 1, 9, 7}) {
+      fl_set.erase(BoxedInt(value));
+      test_set.erase(std::remove(test_set.begin(), test_set.end(), value),
+                     test_set.end());
+    }
+    std::vector<int> actual;
+    for (const auto& box : fl_set)
+      actual.push_back(*box.body);
+    EXPECT_TRUE(actual == test_set)
+        << prefix << ExpectedActualMsg(test_set, actual);
+  }
+}
+
+void FlatMapTest::ThreeWayCompare() {
+  using FlatMap = tools::flat_map<std::string, int, std::greater<std::string>>;
+  using StdMap = FlatMap::std_map;
+  using FlatSet = tools::flat_set<std::string, std::greater<std::string>>;
+  using StdSet = std::set<std::string, std::greater<std::string>>;
+
+  static_assert(FlatMap::key_compare::has_three_way, "");
+  static_assert(FlatSet::key_compare::has_three_way, "");
+
+  auto key_value_pairs = RegularKeyValuePairs();
+  auto keys = RegularKeys();
+  auto keys_with_one_extra(keys);
+  keys_with_one_extra.emplace_back("not found");
+
+  insert_test<FlatMap, StdMap>(key_value_pairs);
+  insert_test<FlatSet, StdSet>(keys);
+  getters_test<FlatMap, StdMap>(key_value_pairs, keys_with_one_extra);
+  getters_test<FlatSet, StdSet>(keys, keys_with_one_extra);
+  erasers_test<FlatMap, StdMap>(key_value_pairs, keys_with_one_extra);
+  erasers_test<FlatSet, StdSet>(keys, keys_with_one_extra);
+}
+
+void FlatMapTest::PrefixedStringKeys() {
+  using FlatMap = tools::flat_map<tools::prefixed_string, int>;
+  using StdMap = FlatMap::std_map;
+  using FlatSet = tools::flat_set<tools::prefixed_string>;
+  using StdSet = FlatSet::std_set;
+
+  // more than 16 elements are sorted unstable, so values are deduplicated
+  auto regular_pairs = RegularKeyValuePairs();
+  RegularFlatMap::std_map unique_pairs(regular_pairs.begin(),
+                                       regular_pairs.end());
+
+  std::vector<FlatMap::value_type> key_value_pairs;
+  std::vector<FlatSet::value_type> keys;
+  for (const auto& kv_pair : unique_pairs) {
+    for (const char* prefix : {"", "shared_prefix_", "shared_prefix", "\xff"}) {
+      key_value_pairs.emplace_back(prefix + kv_pair.first, kv_pair.second);
+      keys.push_back(key_value_pairs.back().first);
+    }
+  }
+  auto keys_with_one_extra(keys);
+  keys_with_one_extra.emplace_back("shared_prefix_not found");
+
+  {
+    const char prefix[] = "prefixed_string ordering ";
+    for (const auto& lhs : keys) {
+      for (const auto& rhs : keys) {
+        EXPECT_EQ(lhs < rhs, lhs.str() < rhs.str()) << prefix << lhs << rhs;
+        EXPECT_EQ(lhs.compare(rhs) < 0, lhs.str().compare(rhs.str()) < 0)
+            << prefix << lhs << rhs;
+        EXPECT_EQ(lhs == rhs, lhs.str() == rhs.str()) << prefix << lhs << rhs;
+      }
+    }
+  }
+
+  insert_test<FlatMap, StdMap>(key_value_pairs);
+  insert_test<FlatSet, StdSet>(keys);
+  getters_test<FlatMap, StdMap>(key_value_pairs, keys_with_one_extra);
+  getters_test<FlatSet, StdSet>(keys, keys_with_one_extra);
+  erasers_test<FlatMap, StdMap>(key_value_pairs, keys_with_one_extra);
+  erasers_test<FlatSet, StdSet>(keys, keys_with_one_extra);
+}
+
+namespace {
+
+// counts all constructions
+struct Counted {
+  static int constructed;
+
+  Counted() { ++constructed; }
+  explicit Counted(int v) : value(v) { ++constructed; }
+  Counted(const Counted& that) : value(that.value) { ++constructed; }
+  Counted(Counted&& that) : value(that.value) { ++constructed; }
+  Counted& operator=(const Counted&) = default;
+  Counted& operator=(Counted&&) = default;
+
+  int value = 0;
+};
+
+int Counted::constructed = 0;
+
+bool operator<(const Counted& lhs, const Counted& rhs) {
+  return lhs.value < rhs.value;
+}
+
+}  // namespace
+
+void FlatMapTest::TryEmplace() {
+  using FlatMap = tools::flat_map<std::string, Counted>;
+  using FlatSet = tools::flat_set<Counted>;
+
+  {
+    const char prefix[] = "try_emplace ";
+    FlatMap fl_map;
+    auto res = fl_map.try_emplace("a", 1);
+    EXPECT_TRUE(res.second) << prefix;
+    EXPECT_EQ(res.first->second.value, 1) << prefix;
+
+    Counted::constructed = 0;
+    std::string key = "a";
+    res = fl_map.try_emplace(key, 2);
+    EXPECT_TRUE(!res.second) << prefix;
+    EXPECT_EQ(res.first->second.value, 1) << prefix;
+    EXPECT_EQ(Counted::constructed, 0) << prefix;
+
+    auto it = fl_map.try_emplace(fl_map.end(), std::string("b"), 3);
+    EXPECT_EQ(it->first, std::string("b")) << prefix;
+    EXPECT_EQ(it->second.value, 3) << prefix;
+    EXPECT_EQ(fl_map.size(), FlatMap::size_type(2)) << prefix;
+  }
+  {
+    const char prefix[] = "insert_or_assign ";
+    FlatMap fl_map;
+    auto res = fl_map.insert_or_assign("a", Counted(1));
+    EXPECT_TRUE(res.second) << prefix;
+    res = fl_map.insert_or_assign("a", Counted(2));
+    EXPECT_TRUE(!res.second) << prefix;
+    EXPECT_EQ(res.first->second.value, 2) << prefix;
+    auto it = fl_map.insert_or_assign(fl_map.begin(), "0", Counted(3));
+    EXPECT_EQ(it, fl_map.begin()) << prefix;
+    EXPECT_EQ(fl_map.size(), FlatMap::size_type(2)) << prefix;
+  }
+  {
+    const char prefix[] = "hints ";
+    FlatMap fl_map;
+    fl_map.try_emplace("b", 1);
+    fl_map.try_emplace("d", 2);
+
+    // right hint
+    auto it = fl_map.try_emplace(fl_map.begin() + 1, "c", 3);
+    EXPECT_EQ(it->first, std::string("c")) << prefix;
+    it = fl_map.insert_or_assign(fl_map.end(), "e", Counted(4));
+    EXPECT_EQ(it->first, std::string("e")) << prefix;
+
+    // wrong hints fall back to a search
+    it = fl_map.try_emplace(fl_map.end(), "a", 5);
+    EXPECT_EQ(it, fl_map.begin()) << prefix;
+    it = fl_map.insert_or_assign(fl_map.begin(), "f", Counted(6));
+    EXPECT_EQ(it->first, std::string("f")) << prefix;
+
+    // hints next to an equal key
+    Counted::constructed = 0;
+    it = fl_map.try_emplace(fl_map.begin() + 1, "b", 7);
+    EXPECT_EQ(it->second.value, 1) << prefix;
+    EXPECT_EQ(Counted::constructed, 0) << prefix;
+    it = fl_map.insert_or_assign(fl_map.begin() + 2, "b", Counted(8));
+    EXPECT_EQ(it->second.value, 8) << prefix;
+
+    std::vector<std::string> keys;
+    for (const auto& value : fl_map)
+      keys.push_back(value.first);
+    EXPECT_EQ(keys, (std::vector<std::string>{"a", "b", "c", "d", "e", "f"}))
+        << prefix;
+  }
+  {
+    const char prefix[] = "emplace existing key ";
+    FlatMap fl_map;
+    fl_map.emplace(std::string("a"), Counted(1));
+    FlatMap::value_type value(std::string("a"), Counted(2));
+
+    Counted::constructed = 0;
+    const std::string key = "a";
+    const Counted mapped(3);
+    EXPECT_TRUE(!fl_map.emplace(key, mapped).second) << prefix;
+    EXPECT_TRUE(!fl_map.emplace(value).second) << prefix;
+    EXPECT_TRUE(!fl_map.insert(value).second) << prefix;
+    fl_map["a"].value += 1;
+    EXPECT_EQ(Counted::constructed, 1) << prefix;
+    EXPECT_EQ(fl_map.at("a").value, 2) << prefix;
+
+    FlatSet fl_set;
+    fl_set.emplace(3);
+    Counted::constructed = 0;
+    EXPECT_TRUE(!fl_set.insert(mapped).second) << prefix;
+    EXPECT_TRUE(!fl_set.emplace(Counted(3)).second) << prefix;
+    EXPECT_EQ(Counted::constructed, 1) << prefix;
+  }
+}
+
+void FlatMapTest::Stats() {
+  using FlatMap = tools::flat_map<std::string, int, std::less<std::string>,
+                                  std::vector<std::pair<std::string, int>>,
+                                  tools::counting_stats>;
+  using StdMap = FlatMap::std_map;
+  using FlatSet = tools::flat_set<std::string, std::less<std::string>,
+                                  std::vector<std::string>,
+                                  tools::timing_stats>;
+  using StdSet = FlatSet::std_set;
+
+  static_assert(sizeof(tools::flat_map<int, int>) ==
+                    sizeof(std::vector<std::pair<int, int>>),
+                "no_stats takes no space");
+
+  auto key_value_pairs = RegularKeyValuePairs();
+  auto keys = RegularKeys();
+  auto keys_with_one_extra(keys);
+  keys_with_one_extra.emplace_back("not found");
+
+  insert_test<FlatMap, StdMap>(key_value_pairs);
+  insert_test<FlatSet, StdSet>(keys);
+  getters_test<FlatMap, StdMap>(key_value_pairs, keys_with_one_extra);
+  getters_test<FlatSet, StdSet>(keys, keys_with_one_extra);
+  erasers_test<FlatMap, StdMap>(key_value_pairs, keys_with_one_extra);
+  erasers_test<FlatSet, StdSet>(keys, keys_with_one_extra);
+
+  {
+    const char prefix[] = "counting_stats ";
+    FlatMap fl_map;
+    fl_map.unsafe_access()->reserve(8);
+    fl_map.stats().reset();
+    for (int i = 0; i < 8; ++i)
+      fl_map.emplace(std::to_string(7 - i), i);
+    auto stats = fl_map.stats().snapshot();
+    EXPECT_EQ(stats.inserted, 8u) << prefix;
+    EXPECT_EQ(stats.elements_moved, 0u + 1 + 2 + 3 + 4 + 5 + 6 + 7) << prefix;
+    EXPECT_EQ(stats.reallocations, 0u) << prefix;
+    EXPECT_EQ(stats.lookups, 8u) << prefix;
+
+    fl_map.stats().reset();
+    const FlatMap& const_map = fl_map;
+    EXPECT_TRUE(const_map.find("3") != const_map.end()) << prefix;
+    EXPECT_TRUE(const_map.find("x") == const_map.end()) << prefix;
+    stats = fl_map.stats().snapshot();
+    EXPECT_EQ(stats.lookups, 2u) << prefix;
+    EXPECT_LE(stats.max_comparisons, 5u) << prefix;
+    EXPECT_GE(stats.comparisons, 6u) << prefix;
+
+    fl_map.stats().reset();
+    fl_map.erase("0");
+    fl_map.erase(fl_map.begin(), fl_map.begin() + 2);
+    stats = fl_map.stats().snapshot();
+    EXPECT_EQ(stats.erased, 3u) << prefix;
+    EXPECT_EQ(stats.elements_moved, 7u + 5) << prefix;
+
+    fl_map.stats().reset();
+    fl_map.unsafe_access()->emplace_back("0", 0);
+    stats = fl_map.stats().snapshot();
+    EXPECT_EQ(stats.sorts, 1u) << prefix;
+    EXPECT_EQ(stats.sorted_elements, 6u) << prefix;
+
+    FlatMap copy(fl_map);
+    EXPECT_EQ(copy.stats().snapshot().sorts, 1u) << prefix;
+
+    fl_map.stats().reset();
+    auto hinted = fl_map.emplace_hint(fl_map.end(), std::string("z"), 1);
+    EXPECT_EQ(hinted->first, "z") << prefix;
+    hinted = fl_map.emplace_hint(fl_map.begin(), "9", 2);
+    EXPECT_EQ(hinted->first, "9") << prefix;
+    hinted = fl_map.emplace_hint(fl_map.end(), "9", 3);
+    EXPECT_EQ(hinted->second, 2) << prefix;
+    stats = fl_map.stats().snapshot();
+    EXPECT_EQ(stats.inserted, 2u) << prefix << "emplace_hint";
+    EXPECT_EQ(stats.lookups, 2u) << prefix << "right hints don't search";
+  }
+  {
+    const char prefix[] = "timing_stats ";
+    FlatSet fl_set;
+    fl_set.insert(keys.begin(), keys.end());
+    for (const auto& key : keys_with_one_extra)
+      fl_set.count(key);
+    auto stats = fl_set.stats().snapshot();
+    EXPECT_EQ(stats.latency(tools::stats_op::insert_range).count(), 1u)
+        << prefix;
+    EXPECT_EQ(stats.latency(tools::stats_op::count).count(),
+              keys_with_one_extra.size())
+        << prefix;
+    EXPECT_EQ(stats.latency(tools::stats_op::find).count(), 0u) << prefix;
+    EXPECT_EQ(stats.lookups, keys_with_one_extra.size()) << prefix;
+  }
+}
+
+template <typename FlatCont>
+void galloping_test(const FlatCont& fl_cont, const std::vector<int>& keys) {
+  for (auto from = fl_cont.begin(); from != fl_cont.end(); ++from) {
+    for (int key : keys) {
+      auto expected = fl_cont.lower_bound(key);
+      if (expected < from)
+        continue;
+      EXPECT_EQ(fl_cont.lower_bound_from(from, key), expected)
+          << "lower_bound_from " << key;
+      auto found = fl_cont.find_from(from, key);
+      EXPECT_EQ(found, fl_cont.find(key)) << "find_from " << key;
+    }
+  }
+}
+
+void FlatMapTest::Galloping() {
+  using FlatMap = tools::flat_map<int, int, std::greater<int>>;
+  using FlatSet = tools::flat_set<int, std::less<int>, std::vector<int>,
+                                  tools::counting_stats>;
+
+  std::vector<int> keys;
+  for (int i = -1; i < 40; ++i)
+    keys.push_back(i);
+
+  FlatSet fl_set;
+  FlatMap fl_map;
+  for (int i = 0; i < 37; i += 2) {
+    fl_set.insert(i);
+    fl_map[i * 2] = i;
+  }
+  galloping_test(fl_set, keys);
+  std::reverse(keys.begin(), keys.end());
+  galloping_test(fl_map, keys);
+
+  {
+    const char prefix[] = "gallop comparisons ";
+    FlatSet big;
+    {
+      auto guard = big.unsafe_access();
+      for (int i = 0; i < 1 << 16; ++i)
+        guard->push_back(i);
+    }
+    big.stats().reset();
+    EXPECT_EQ(*big.lower_bound_from(big.begin() + 1000, 1003), 1003)
+        << prefix;
+    EXPECT_LE(big.stats().snapshot().comparisons, 5u) << prefix;
+  }
+  {
+    const char prefix[] = "flat_cursor ";
+    FlatSet lhs;
+    FlatSet rhs;
+    std::vector<int> expected;
+    for (int i = 0; i < 1000; ++i) {
+      lhs.insert(i * 3);
+      rhs.insert(i * 5);
+      if (i * 3 % 5 == 0)
+        expected.push_back(i * 3);
+    }
+
+    std::vector<int> actual;
+    auto cursor = tools::make_flat_cursor(rhs);
+    for (int key : lhs) {
+      if (cursor.done())
+        break;
+      if (cursor.find(key) != rhs.end())
+        actual.push_back(key);
+    }
+    EXPECT_TRUE(actual == expected)
+        << prefix << ExpectedActualMsg(expected, actual);
+  }
+}
+
+void FlatMapTest::Persistent() {
+  using PersistentMap =
+      tools::persistent_flat_map<int, int, std::less<int>, 4>;
+  using StdMap = std::map<int, int>;
+
+  PersistentMap map;
+  StdMap test_map;
+  std::vector<std::pair<PersistentMap, StdMap>> versions;
+
+  // small chunks, so that there are many splits and empty chunks
+  std::uint64_t state = 7;
+  for (int step = 0; step < 2000; ++step) {
+    state = state * 6364136223846793005u + 1442695040888963407u;
+    int key = static_cast<int>(state >> 58);
+    int value = static_cast<int>((state >> 32) & 0xff);
+    switch ((state >> 40) % 4) {
+      case 0:
+        EXPECT_EQ(map.insert({key, value}).second,
+                  test_map.insert({key, value}).second)
+            << "persistent insert";
+        break;
+      case 1:
+        map.insert_or_assign(key, value);
+        test_map[key] = value;
+        break;
+      case 2:
+        EXPECT_EQ(map.erase(key), test_map.erase(key)) << "persistent erase";
+        break;
+      default:
+        versions.emplace_back(map.snapshot(), test_map);
+    }
+    EXPECT_TRUE(check_map(map, test_map))
+        << "persistent " << ExpectedActualMsg(test_map, map);
+  }
+
+  const char prefix[] = "persistent snapshots ";
+  for (const auto& version : versions) {
+    const PersistentMap& snapshot = version.first;
+    const StdMap& expected = version.second;
+    EXPECT_TRUE(check_map(snapshot, expected))
+        << prefix << ExpectedActualMsg(expected, snapshot);
+    for (int key = -1; key <= 64; ++key) {
+      auto pos = snapshot.lower_bound(key);
+      auto expected_pos = expected.lower_bound(key);
+      EXPECT_EQ(std::distance(snapshot.begin(), pos),
+                std::distance(expected.begin(), expected_pos))
+          << prefix << "lower_bound " << key;
+      EXPECT_EQ(std::distance(snapshot.begin(), snapshot.upper_bound(key)),
+                std::distance(expected.begin(), expected.upper_bound(key)))
+          << prefix << "upper_bound " << key;
+      EXPECT_EQ(snapshot.count(key), expected.count(key))
+          << prefix << "count " << key;
+    }
+    EXPECT_TRUE(std::equal(snapshot.rbegin(), snapshot.rend(),
+                           expected.rbegin(), AnyPairEquals()))
+        << prefix << "reverse";
+  }
+
+  {
+    const char prefix[] = "persistent sharing ";
+    std::vector<std::pair<int, int>> body;
+    for (int i = 0; i < 1000; ++i)
+      body.emplace_back(i, i);
+    PersistentMap big(body.begin(), body.end());
+    auto old = big.snapshot();
+    EXPECT_EQ(big.shared_chunks(old), big.chunk_count()) << prefix;
+    big.insert_or_assign(500, -1);
+    EXPECT_EQ(big.shared_chunks(old), big.chunk_count() - 1) << prefix;
+    EXPECT_EQ(old.at(500), 500) << prefix;
+    EXPECT_EQ(big.at(500), -1) << prefix;
+  }
+  {
+    const char prefix[] = "persistent stateful comparator ";
+    struct flagged_less {
+      bool reversed = false;
+      bool operator()(int lhs, int rhs) const {
+        return reversed ? rhs < lhs : lhs < rhs;
+      }
+    };
+    using ReversedMap =
+        tools::persistent_flat_map<int, int, flagged_less, 4>;
+    flagged_less reversed;
+    reversed.reversed = true;
+    ReversedMap::key_compare comp(reversed);
+
+    ReversedMap map(comp);
+    for (int i = 0; i < 20; ++i)
+      map.insert({i, i});
+    EXPECT_TRUE(map.key_comp().cmp(2, 1)) << prefix;
+    EXPECT_EQ(map.begin()->first, 19) << prefix;
+    EXPECT_EQ(map.at(5), 5) << prefix;
+    EXPECT_EQ(map.count(20), 0u) << prefix;
+
+    std::vector<std::pair<int, int>> body{{1, 1}, {3, 3}, {2, 2}};
+    ReversedMap from_range(body.begin(), body.end(), comp);
+    auto snapshot = from_range.snapshot();
+    from_range.insert({0, 0});
+    EXPECT_TRUE(snapshot.key_comp().cmp(2, 1)) << prefix;
+    EXPECT_EQ(snapshot.begin()->first, 3) << prefix;
+    EXPECT_EQ(std::prev(from_range.end())->first, 0) << prefix;
+  }
+}
+
+void FlatMapTest::Filtered() {
+  using FilteredSet = tools::filtered_flat_set<int>;
+
+  FilteredSet fl_set;
+  std::set<int> test_set;
+  auto check = [&](const char* prefix) {
+    for (int key = -10; key < 2300; ++key) {
+      EXPECT_EQ(fl_set.count(key), test_set.count(key)) << prefix << key;
+      EXPECT_EQ(fl_set.find(key) != fl_set.end(),
+                test_set.find(key) != test_set.end())
+          << prefix << key;
+    }
+  };
+
+  for (int i = 0; i < 1000; i += 3) {
+    fl_set.insert(i);
+    test_set.insert(i);
+  }
+  check("filtered insert ");
+  for (int i = 0; i < 1000; i += 7) {
+    fl_set.erase(i);
+    test_set.erase(i);
+  }
+  check("filtered erase ");
+  {
+    auto guard = fl_set.unsafe_access();
+    for (int i = 1; i < 1000; i += 5) {
+      guard->push_back(i);
+      test_set.insert(i);
+    }
+  }
+  check("filtered unsafe_access ");
+  // a lookup in the middle of a region must not leave a filter of the part
+  // of the body, pushed before it
+  {
+    auto guard = fl_set.unsafe_access();
+    guard->push_back(2001);
+    test_set.insert(2001);
+    EXPECT_EQ(fl_set.count(0), 0u) << "filtered lookup inside unsafe_access";
+    for (int i = 2002; i < 2100; ++i) {
+      guard->push_back(i);
+      test_set.insert(i);
+    }
+  }
+  check("filtered lookup inside unsafe_access ");
+  {
+    auto guard = fl_set.unsafe_access();
+    EXPECT_EQ(fl_set.count(2001), 1u) << "filtered before release ";
+    for (int i = 2100; i < 2200; ++i) {
+      guard->push_back(i);
+      test_set.insert(i);
+    }
+    guard.release();
+  }
+  check("filtered unsafe_region::release ");
+  std::vector<int> range = {1050, 1010, 1040};
+  fl_set.insert(range.begin(), range.end());
+  test_set.insert(range.begin(), range.end());
+  check("filtered insert range ");
+  fl_set.set_bits_per_key(0);
+  EXPECT_EQ(fl_set.filter_memory_bytes(), 0u) << "filtered off ";
+  check("filtered off ");
+
+  {
+    const char prefix[] = "filtered false positives ";
+    std::vector<int> keys;
+    for (int i = 0; i < 100000; ++i)
+      keys.push_back(i * 2);
+    FilteredSet big(keys.begin(), keys.end(), 16);
+    big.rebuild_filter();
+    EXPECT_LE(big.filter_memory_bytes(), 100000u * 16 / 8 + 64) << prefix;
+    int false_positives = 0;
+    for (int i = 0; i < 100000; ++i)
+      false_positives += big.may_contain(i * 2 + 1);
+    EXPECT_LT(false_positives, 100000 / 100) << prefix << false_positives;
+  }
+}
+
+template <typename FrozenCont, typename FlatCont, typename Keys>
+void frozen_test(const FlatCont& fl_cont, const Keys& keys) {
+  auto frozen = tools::freeze(fl_cont);
+  EXPECT_TRUE(frozen.hashed()) << "frozen hashed";
+  static_assert(std::is_same<decltype(frozen), FrozenCont>::value, "");
+  for (const auto& key : keys) {
+    EXPECT_EQ(frozen.find(key), fl_cont.find(key) - fl_cont.begin() +
+                                    frozen.begin())
+        << "frozen find " << key;
+    EXPECT_EQ(frozen.count(key), fl_cont.count(key)) << "frozen count " << key;
+    EXPECT_EQ(frozen.lower_bound(key) - frozen.begin(),
+              fl_cont.lower_bound(key) - fl_cont.begin())
+        << "frozen lower_bound " << key;
+  }
+  auto thawed = std::move(frozen).thaw();
+  EXPECT_TRUE(thawed == fl_cont) << "frozen thaw";
+}
+
+void FlatMapTest::Frozen() {
+  using FlatMap = tools::flat_map<std::string, int, std::greater<std::string>>;
+  using FlatSet = tools::flat_set<int>;
+
+  auto key_value_pairs = RegularKeyValuePairs();
+  auto keys = RegularKeys();
+  keys.emplace_back("not found");
+  FlatMap fl_map(key_value_pairs.begin(), key_value_pairs.end());
+  frozen_test<tools::frozen_flat_map<std::string, int,
+                                     std::greater<std::string>>>(fl_map, keys);
+  EXPECT_EQ(tools::freeze(fl_map).at("long"), 1233) << "frozen at";
+
+  FlatSet fl_set;
+  std::vector<int> int_keys;
+  {
+    auto guard = fl_set.unsafe_access();
+    for (int i = 0; i < 20000; ++i) {
+      if (i % 3)
+        guard->push_back(i);
+      int_keys.push_back(i);
+    }
+  }
+  frozen_test<tools::frozen_flat_set<int>>(fl_set, int_keys);
+  frozen_test<tools::frozen_flat_set<int>>(FlatSet(), int_keys);
+
+  {
+    const char prefix[] = "frozen same hash ";
+    struct constant_hash {
+      std::size_t operator()(int) const { return 1; }
+    };
+    tools::frozen_flat_container<FlatSet, constant_hash> frozen(fl_set);
+    EXPECT_TRUE(!frozen.hashed()) << prefix;
+    EXPECT_EQ(frozen.count(3), 0u) << prefix;
+    EXPECT_EQ(frozen.count(4), 1u) << prefix;
+  }
+}
+
+template <typename CompressedSet, typename Keys>
+void compressed_test(const Keys& keys,
+                     const std::vector<std::uint64_t>& probes) {
+  using UInt = typename CompressedSet::key_type;
+  std::set<UInt> test_set(keys.begin(), keys.end());
+  CompressedSet set(keys.begin(), keys.end());
+
+  const char prefix[] = "compressed ";
+  EXPECT_TRUE(std::equal(set.begin(), set.end(), test_set.begin()) &&
+              set.size() == test_set.size())
+      << prefix << "iteration";
+  auto decompressed = set.decompress();
+  EXPECT_TRUE(std::equal(decompressed.begin(), decompressed.end(),
+                         test_set.begin()))
+      << prefix << "decompress";
+  for (std::uint64_t probe : probes) {
+    auto key = static_cast<UInt>(probe);
+    EXPECT_EQ(set.lower_bound(key) - set.begin(),
+              std::distance(test_set.begin(), test_set.lower_bound(key)))
+        << prefix << "lower_bound " << probe;
+    EXPECT_EQ(set.upper_bound(key) - set.begin(),
+              std::distance(test_set.begin(), test_set.upper_bound(key)))
+        << prefix << "upper_bound " << probe;
+    EXPECT_EQ(set.count(key), test_set.count(key))
+        << prefix << "count " << probe;
+  }
+}
+
+void FlatMapTest::Compressed() {
+  std::vector<std::uint64_t> keys;
+  std::vector<std::uint64_t> probes = {0, 1, ~std::uint64_t(0),
+                                       ~std::uint64_t(0) - 1};
+  std::uint64_t state = 3;
+  std::uint64_t id = 1000;
+  for (int i = 0; i < 5000; ++i) {
+    state = state * 6364136223846793005u + 1442695040888963407u;
+    id += (state >> 60) + 1;
+    keys.push_back(id);
+    probes.push_back(id);
+    probes.push_back(id + 1);
+    probes.push_back(id - 1);
+  }
+  // a block with 64 bit wide differences
+  keys.push_back(~std::uint64_t(0));
+  keys.push_back(~std::uint64_t(0) - 5);
+  keys.push_back(7);
+
+  compressed_test<tools::compressed_flat_set<>>(keys, probes);
+  compressed_test<tools::compressed_flat_set<std::uint64_t, 1>>(keys, probes);
+  compressed_test<tools::compressed_flat_set<std::uint16_t, 7>>(keys, probes);
+  compressed_test<tools::compressed_flat_set<>>(std::vector<std::uint64_t>(),
+                                                probes);
+
+  tools::compressed_flat_set<> dense(keys.begin(), keys.end() - 3);
+  EXPECT_LT(dense.memory_bytes() * 4, keys.size() * sizeof(std::uint64_t))
+      << "compressed memory " << dense.memory_bytes();
+}
+
+void FlatMapTest::Parallel() {
+  using FlatMap = tools::flat_map<int, int>;
+
+  FlatMap fl_map;
+  {
+    auto guard = fl_map.unsafe_access();
+    for (int i = 0; i < 100000; ++i)
+      guard->emplace_back(i * 2, i);
+  }
+  std::vector<int> probes;
+  for (int i = 0; i < 50000; ++i)
+    probes.push_back((i * 7919) % 200001);
+
+  for (std::size_t threads : {1u, 3u}) {
+    tools::thread_pool pool(threads);
+    for (std::size_t grain : {0u, 1u, 1000u, 1u << 20}) {
+      const char prefix[] = "parallel ";
+      auto found = tools::find_many(fl_map, probes.begin(), probes.end(),
+                                    pool, grain);
+      bool same = found.size() == probes.size();
+      for (std::size_t i = 0; same && i < probes.size(); ++i)
+        same = found[i] == fl_map.find(probes[i]);
+      EXPECT_TRUE(same) << prefix << "find_many " << threads << ' ' << grain;
+
+      auto range = tools::key_range(fl_map, 1000, 150001);
+      std::atomic<long long> sum_for_each{0};
+      tools::parallel_for_each(range,
+                               [&](const FlatMap::value_type& element) {
+                                 sum_for_each += element.second;
+                               },
+                               pool, grain);
+      long long expected = 0;
+      for (const auto& element : range)
+        expected += element.second;
+      EXPECT_EQ(sum_for_each.load(), expected)
+          << prefix << "parallel_for_each " << threads << ' ' << grain;
+
+      // not commutative, so the order of chunks matters
+      auto keys = tools::parallel_reduce(
+          tools::key_range(fl_map, 199900, 300000), std::vector<int>(),
+          [](std::vector<int> res, const FlatMap::value_type& element) {
+            res.push_back(element.first);
+            return res;
+          },
+          [](std::vector<int> lhs, const std::vector<int>& rhs) {
+            lhs.insert(lhs.end(), rhs.begin(), rhs.end());
+            return lhs;
+          },
+          pool, grain);
+      std::vector<int> expected_keys;
+      for (int key = 199900; key < 200000; key += 2)
+        expected_keys.push_back(key);
+      EXPECT_TRUE(keys == expected_keys)
+          << prefix << "parallel_reduce " << threads << ' ' << grain;
+    }
+
+    bool thrown = false;
+    try {
+      pool.parallel_for(10, [](std::size_t i) {
+        if (i == 7)
+          throw std::runtime_error("task");
+      });
+    } catch (const std::runtime_error&) {
+      thrown = true;
+    }
+    EXPECT_TRUE(thrown) << "parallel exception " << threads;
+  }
+}
+
+template <typename View, typename FlatCont, typename Keys>
+void view_test(const View& view, const FlatCont& fl_cont, const Keys& keys) {
+  const char prefix[] = "view ";
+  EXPECT_EQ(view.size(), fl_cont.size()) << prefix << "size";
+  EXPECT_TRUE(std::equal(view.begin(), view.end(), fl_cont.begin(),
+                         fl_cont.end()))
+      << prefix << "elements";
+  EXPECT_TRUE(std::equal(view.rbegin(), view.rend(), fl_cont.rbegin(),
+                         fl_cont.rend()))
+      << prefix << "reverse elements";
+
+  auto index = [&](typename View::const_iterator pos) {
+    return std::distance(view.begin(), pos);
+  };
+  auto fl_index = [&](typename FlatCont::const_iterator pos) {
+    return std::distance(fl_cont.begin(), pos);
+  };
+  for (const auto& key : keys) {
+    EXPECT_EQ(index(view.find(key)), fl_index(fl_cont.find(key)))
+        << prefix << "find";
+    EXPECT_EQ(view.count(key), fl_cont.count(key)) << prefix << "count";
+    EXPECT_EQ(index(view.lower_bound(key)), fl_index(fl_cont.lower_bound(key)))
+        << prefix << "lower_bound";
+    EXPECT_EQ(index(view.upper_bound(key)), fl_index(fl_cont.upper_bound(key)))
+        << prefix << "upper_bound";
+    auto range = view.equal_range(key);
+    auto fl_range = fl_cont.equal_range(key);
+    EXPECT_EQ(index(range.first), fl_index(fl_range.first))
+        << prefix << "equal_range";
+    EXPECT_EQ(index(range.second), fl_index(fl_range.second))
+        << prefix << "equal_range";
+  }
+}
+
+void FlatMapTest::Views() {
+  using FlatMap = tools::flat_map<int, int>;
+  using FlatSet = tools::flat_set<std::string, std::greater<std::string>>;
+
+  std::vector<std::pair<int, int>> pairs;
+  for (int i = 0; i < 1000; ++i)
+    pairs.emplace_back(i * 3, i);
+  std::vector<int> keys;
+  for (int key = -2; key < 3002; ++key)
+    keys.push_back(key);
+
+  // over a plain buffer, the view doesn't copy it
+  const tools::flat_map_view<int, int> map_view(tools::sorted_unique, pairs);
+  EXPECT_EQ(map_view.begin(), pairs.data()) << "view copied elements";
+  FlatMap fl_map(pairs.begin(), pairs.end());
+  view_test(map_view, fl_map, keys);
+  EXPECT_EQ(map_view.at(300), 100) << "view at";
+  tools::flat_map_view<int, int> mutable_view(tools::sorted_unique, pairs);
+  EXPECT_EQ(mutable_view.at(300), 100) << "non const view at";
+  EXPECT_TRUE(map_view == tools::make_flat_view(fl_map)) << "view ==";
+  EXPECT_TRUE(!(map_view < tools::make_flat_view(fl_map))) << "view <";
+
+  view_test(tools::flat_map_view<int, int>(), FlatMap(), keys);
+
+  std::vector<std::string> strings{"a", "ab", "b", "ba", "c", "xyz"};
+  FlatSet fl_set(strings.begin(), strings.end());
+  auto set_view = tools::make_flat_view(fl_set);
+  EXPECT_EQ(set_view.begin(), &*fl_set.begin()) << "view copied elements";
+  view_test(set_view, fl_set,
+            std::vector<std::string>{"", "a", "aa", "ab", "c", "xyz", "z"});
+
+  // the same lookups, the same costs
+  tools::flat_map_view<int, int, std::less<int>, tools::counting_stats>
+      counted_view(tools::sorted_unique, {pairs.data(), pairs.size()});
+  tools::flat_map<int, int, std::less<int>,
+                  std::vector<std::pair<int, int>>, tools::counting_stats>
+      counted_map(pairs.begin(), pairs.end());
+  for (int key : keys) {
+    counted_view.find(key);
+    counted_map.find(key);
+  }
+  EXPECT_EQ(counted_view.stats().snapshot().comparisons,
+            counted_map.stats().snapshot().comparisons)
+      << "view comparisons";
+}
+
+namespace {
+
+std::ostream& operator<<(std::ostream& out, const Counted& that) {
+  return out << "counted " << that.value;
+}
+
+// too big for the buffer
+struct Wide {
+  char text[64] = "wide";
+};
+
+std::ostream& operator<<(std::ostream& out, const Wide& that) {
+  return out << that.text;
+}
+
+template <typename Range>
+std::string stream_all(const Range& range) {
+  std::ostringstream out;
+  for (const auto& element : range)
+    out << element << ';';
+  return out.str();
+}
+
+}  // namespace
+
+void FlatMapTest::Streamable() {
+  using tools::streamable;
+  const char prefix[] = "streamable ";
+
+  static_assert(streamable::fits_inline<int>(), "");
+  static_assert(streamable::fits_inline<std::string>(), "");
+  static_assert(!streamable::fits_inline<Wide>(), "");
+  static_assert(!streamable::fits_inline<Counted>(), "throwing move");
+  static_assert(!tools::basic_streamable<8>::fits_inline<std::string>(), "");
+
+  std::vector<streamable> values{1, 8u, std::string("abc"), Wide(),
+                                 Counted(5), 'c'};
+  const std::string expected = "1;8;abc;wide;counted 5;c;";
+  EXPECT_EQ(stream_all(values), expected) << prefix << "stream";
+
+  auto copy = values;
+  EXPECT_EQ(stream_all(copy), expected) << prefix << "copy";
+  copy[2] = std::string(100, 'x');
+  EXPECT_EQ(stream_all(values), expected) << prefix << "copy is deep";
+
+  // reallocation moves every element
+  auto moved = std::move(copy);
+  moved.reserve(moved.capacity() * 2);
+  EXPECT_EQ(stream_all(moved),
+            "1;8;" + std::string(100, 'x') + ";wide;counted 5;c;")
+      << prefix << "move";
+
+  streamable from = std::string("from");
+  streamable to = std::move(from);
+  EXPECT_TRUE(from.empty()) << prefix << "moved from";
+  EXPECT_EQ(stream_all(std::vector<streamable>{from, to}), ";from;")
+      << prefix << "moved from streams nothing";
+
+  auto& alias = to;
+  to = alias;
+  to = Wide();
+  to = values[4];
+  EXPECT_EQ(stream_all(std::vector<streamable>{to}), "counted 5;")
+      << prefix << "assign";
+
+  std::vector<tools::basic_streamable<8>> small{1, std::string("heap")};
+  auto small_copy = small;
+  EXPECT_EQ(stream_all(small_copy), "1;heap;") << prefix << "small buffer";
+}
+
+void FlatMapTest::StreamableCollection() {
+  const char prefix[] = "streamable_collection ";
+  tools::streamable_collection values;
+  EXPECT_TRUE(values.empty()) << prefix << "empty";
+
+  values.insert(1);
+  values.insert(std::string("a"));
+  values.insert(2);
+  values.insert(Wide());
+  values.emplace<std::string>(3, 'b');
+  values.insert(Counted(5));
+  EXPECT_EQ(values.size(), 6u) << prefix << "size";
+  EXPECT_EQ(values.segment_count(), 4u) << prefix << "segments";
+
+  auto streamed = [](const tools::streamable_collection& that) {
+    std::ostringstream out;
+    that.stream(out, ";");
+    return out.str();
+  };
+  const std::string expected = "1;2;a;bbb;wide;counted 5;";
+  EXPECT_EQ(streamed(values), expected) << prefix << "grouped by type";
+
+  std::ostringstream plain;
+  plain << values;
+  EXPECT_EQ(plain.str(), "12abbbwidecounted 5") << prefix << "operator<<";
+
+  int sum = 0;
+  values.for_each<int>([&](int value) { sum += value; });
+  EXPECT_EQ(sum, 3) << prefix << "for_each";
+  values.for_each<double>([&](double) { ++sum; });
+  EXPECT_EQ(sum, 3) << prefix << "for_each of a missing type";
+
+  auto copy = values;
+  copy.insert(4);
+  EXPECT_EQ(streamed(values), expected) << prefix << "copy is deep";
+  EXPECT_EQ(streamed(copy), "1;2;4;a;bbb;wide;counted 5;") << prefix << "copy";
+
+  auto moved = std::move(copy);
+  EXPECT_EQ(moved.size(), 7u) << prefix << "move";
+  // the last inserted type of the moved from collection was int
+  copy.insert(8);
+  EXPECT_EQ(streamed(copy), "8;") << prefix << "reuse after move";
+  moved = std::move(copy);
+  copy.insert(9);
+  copy.insert(std::string("d"));
+  EXPECT_EQ(streamed(copy), "9;d;") << prefix << "reuse after move assign";
+  EXPECT_EQ(streamed(moved), "8;") << prefix << "move assign";
+  copy = values;
+  EXPECT_EQ(streamed(copy), expected) << prefix << "assign";
+
+  values.clear();
+  EXPECT_TRUE(values.empty()) << prefix << "clear";
+  values.insert(std::string("c"));
+  values.insert(7);
+  EXPECT_EQ(streamed(values), "7;c;") << prefix << "segments stay";
+}
+
+void FlatMapTest::Upsert() {
+  using FlatMap = tools::flat_map<int, std::string>;
+  using StdMap = std::map<int, std::string>;
+  auto concat = [](std::string existing, const std::string& incoming) {
+    return existing + incoming;
+  };
+
+  FlatMap fl_map;
+  StdMap std_map;
+  std::vector<std::pair<int, std::string>> batch;
+  for (int round = 0; round < 20; ++round) {
+    batch.clear();
+    for (int i = 0; i < round * 7; ++i) {
+      int key = (i * 7919 + round * 31) % 50;
+      batch.emplace_back(key, std::to_string(round * 1000 + i) + ',');
+    }
+    fl_map.upsert_many(batch.begin(), batch.end(), concat);
+    for (const auto& element : batch)
+      std_map[element.first] = concat(std_map[element.first], element.second);
+    EXPECT_TRUE(check_map(fl_map, std_map))
+        << "upsert_many " << round << ' ' << Serialize(fl_map);
+  }
+
+  {
+    const char prefix[] = "merge_with ";
+    tools::flat_map<std::string, int> counts;
+    std::vector<std::pair<std::string, int>> words{
+        {"b", 1}, {"a", 1}, {"b", 1}, {"c", 1}, {"b", 1}};
+    counts.upsert_many(words.begin(), words.end(), std::plus<int>());
+    tools::flat_map<std::string, int> more;
+    more.insert({"0", 5});
+    more.insert({"b", 10});
+    counts.merge_with(more, std::plus<int>());
+    counts.merge_with(counts, std::plus<int>());
+    counts.merge_with(std::move(more), std::minus<int>());
+    std::vector<std::pair<std::string, int>> expected{
+        {"0", 5}, {"a", 2}, {"b", 16}, {"c", 2}};
+    EXPECT_TRUE(check_map(counts, expected)) << prefix << Serialize(counts);
+  }
+
+  {
+    const char prefix[] = "upsert_many throws ";
+    tools::flat_map<int, int> fl_ints;
+    fl_ints.insert({1, 1});
+    fl_ints.insert({3, 3});
+    std::vector<std::pair<int, int>> ints{{2, 2}, {3, 3}, {4, 4}, {4, 4}};
+    bool thrown = false;
+    try {
+      fl_ints.upsert_many(ints.begin(), ints.end(), [](int, int) -> int {
+        throw std::runtime_error("combine");
+      });
+    } catch (const std::runtime_error&) {
+      thrown = true;
+    }
+    EXPECT_TRUE(thrown) << prefix;
+    EXPECT_EQ(fl_ints.size(), 2u) << prefix << "appended are dropped";
+  }
+
+  {
+    const char prefix[] = "upsert_many stats ";
+    tools::flat_map<int, int, std::less<int>,
+                    std::vector<std::pair<int, int>>, tools::counting_stats>
+        counted;
+    std::vector<std::pair<int, int>> ints{{2, 1}, {2, 1}, {0, 1}};
+    counted.upsert_many(ints.begin(), ints.end(), std::plus<int>());
+    counted.upsert_many(ints.begin(), ints.end(), std::plus<int>());
+    EXPECT_EQ(counted.at(2), 4) << prefix;
+    EXPECT_EQ(counted.stats().snapshot().inserted, 2u) << prefix;
+  }
+}
+
+namespace {
+
+// counts element comparisons of containers
+struct EqualityCounted {
+  static int compared;
+
+  int value;
+};
+
+int EqualityCounted::compared = 0;
+
+bool operator<(const EqualityCounted& lhs, const EqualityCounted& rhs) {
+  return lhs.value < rhs.value;
+}
+
+bool operator==(const EqualityCounted& lhs, const EqualityCounted& rhs) {
+  ++EqualityCounted::compared;
+  return lhs.value == rhs.value;
+}
+
+}  // namespace
+
+void FlatMapTest::CopyOnWrite() {
+  using CowMap = tools::cow_flat_map<int, std::string>;
+  const char prefix[] = "copy on write ";
+
+  std::vector<std::pair<int, std::string>> pairs;
+  for (int i = 0; i < 100; ++i)
+    pairs.emplace_back(i * 2, std::to_string(i));
+  CowMap original(pairs.begin(), pairs.end());
+  const CowMap& const_original = original;
+  auto first_element = [](const CowMap& map) { return &*map.begin(); };
+
+  CowMap copy = const_original;
+  const CowMap& const_copy = copy;
+  EXPECT_EQ(first_element(copy), first_element(original))
+      << prefix << "copies share";
+  EXPECT_TRUE(copy == original) << prefix << "==";
+  EXPECT_EQ(const_copy.at(10), "5") << prefix << "const reads don't detach";
+  EXPECT_EQ(first_element(copy), first_element(original)) << prefix;
+
+  copy[10] += "!";
+  EXPECT_TRUE(first_element(copy) != first_element(original))
+      << prefix << "operator[] detaches";
+  EXPECT_EQ(const_original.at(10), "5") << prefix << "original unchanged";
+  EXPECT_EQ(copy.at(10), "5!") << prefix;
+
+  CowMap inserted = const_original;
+  // the position is taken from the shared body
+  auto pos = const_original.find(20);
+  inserted.erase(pos);
+  inserted.insert({1, "odd"});
+  EXPECT_EQ(const_original.size(), 100u) << prefix << "erase detaches";
+  EXPECT_EQ(inserted.size(), 100u) << prefix;
+  EXPECT_EQ(inserted.count(20), 0u) << prefix << "erase by shared position";
+  EXPECT_EQ(inserted.count(1), 1u) << prefix;
+  EXPECT_TRUE(std::equal(original.begin(), original.end(), pairs.begin(),
+                         pairs.end()))
+      << prefix << "original elements";
+
+  CowMap accessed = const_original;
+  {
+    auto guard = accessed.unsafe_access();
+    guard->emplace_back(-1, "first");
+  }
+  EXPECT_EQ(accessed.begin()->second, "first") << prefix << "unsafe_access";
+  EXPECT_EQ(const_original.begin()->second, "0") << prefix;
+
+  CowMap at_copy = const_original;
+  at_copy.at(10) = "99";
+  EXPECT_EQ(const_original.at(10), "5") << prefix << "non const at detaches";
+  EXPECT_EQ(at_copy.at(10), "99") << prefix;
+
+  CowMap galloped = const_original;
+  auto from = galloped.cbegin();
+  auto found = galloped.find_from(from, 30);
+  found->second = "found";
+  auto bound = galloped.lower_bound_from(galloped.cbegin(), 41);
+  bound->second = "bound";
+  EXPECT_EQ(found - galloped.begin(), 15) << prefix << "find_from position";
+  EXPECT_EQ(bound - galloped.begin(), 21) << prefix << "lower_bound_from";
+  EXPECT_TRUE(galloped.at(30) == "found" && galloped.at(42) == "bound")
+      << prefix << "galloping detaches";
+  EXPECT_TRUE(const_original.at(30) == "15" && const_original.at(42) == "21")
+      << prefix << "galloping leaves the original";
+
+  CowMap cleared = const_original;
+  cleared.clear();
+  EXPECT_TRUE(cleared.empty() && const_original.size() == 100u)
+      << prefix << "clear";
+  cleared.insert({5, "5"});
+  EXPECT_TRUE(cleared.size() == 1u && const_original.size() == 100u)
+      << prefix << "insert after clear";
+
+  using CowSet = tools::cow_flat_set<EqualityCounted>;
+  std::vector<EqualityCounted> values{{3}, {1}, {2}};
+  CowSet set(values.begin(), values.end());
+  CowSet set_copy = set;
+  CowSet equal_set(values.begin(), values.end());
+  EqualityCounted::compared = 0;
+  EXPECT_TRUE(set == set_copy) << prefix << "shared ==";
+  EXPECT_EQ(EqualityCounted::compared, 0) << prefix << "shared == compares";
+  EXPECT_TRUE(!(set < set_copy)) << prefix << "shared <";
+  EXPECT_TRUE(set == equal_set) << prefix << "equal ==";
+  EXPECT_EQ(EqualityCounted::compared, 3) << prefix << "equal == compares";
+}
+
+template <typename Key>
+void normalized_order_test(const std::vector<Key>& keys, const char* name) {
+  int mismatches = 0;
+  for (const auto& lhs : keys) {
+    for (const auto& rhs : keys) {
+      int normalized = tools::normalized_key<Key>(lhs).compare(rhs);
+      int expected = std::less<Key>()(lhs, rhs)   ? -1
+                     : std::less<Key>()(rhs, lhs) ? 1
+                                                  : 0;
+      mismatches += (normalized > 0) - (normalized < 0) != expected;
+    }
+  }
+  EXPECT_EQ(mismatches, 0) << "normalized key order " << name;
+}
+
+void FlatMapTest::NormalizedKeys() {
+  using Composite = std::tuple<std::int64_t, std::string, std::uint32_t>;
+  std::vector<Composite> composites;
+  const std::string strings[] = {"",  "a",   std::string("a\0", 2),
+                                 std::string("a\0b", 3), "a\xff", "ab",
+                                 std::string("\0", 1)};
+  for (std::int64_t first : {INT64_MIN, std::int64_t(-300), std::int64_t(-1),
+                             std::int64_t(0), std::int64_t(1),
+                             std::int64_t(256), INT64_MAX}) {
+    for (const auto& second : strings) {
+      for (std::uint32_t third : {0u, 1u, 0x80000000u, UINT32_MAX})
+        composites.emplace_back(first, second, third);
+    }
+  }
+  normalized_order_test(composites, "tuple");
+
+  std::vector<std::pair<double, bool>> doubles;
+  for (double value : {-1e300, -2.5, -1.0, -0.0, 0.0, 1e-300, 1.0, 3.5,
+                       std::numeric_limits<double>::infinity(),
+                       -std::numeric_limits<double>::infinity()}) {
+    doubles.emplace_back(value, false);
+    doubles.emplace_back(value, true);
+  }
+  normalized_order_test(doubles, "double");
+
+  std::vector<std::pair<std::int8_t, char>> small;
+  for (int first : {-128, -1, 0, 1, 127}) {
+    for (char second : {'\0', 'a', '\x7f'})
+      small.emplace_back(static_cast<std::int8_t>(first), second);
+  }
+  normalized_order_test(small, "small integers");
+
+  using NormalizedMap = tools::flat_map<tools::normalized_key<Composite>, int>;
+  std::vector<std::pair<tools::normalized_key<Composite>, int>> pairs;
+  tools::flat_map<Composite, int> fl_map;
+  for (std::size_t i = 0; i < composites.size(); ++i) {
+    int mapped = static_cast<int>(i);
+    pairs.emplace_back(composites[i], mapped);
+    fl_map.insert({composites[i], mapped});
+  }
+  std::reverse(pairs.begin(), pairs.end());
+  NormalizedMap normalized_map(pairs.begin(), pairs.end());
+  EXPECT_TRUE(std::equal(normalized_map.begin(), normalized_map.end(),
+                         fl_map.begin(), fl_map.end(),
+                         [](const NormalizedMap::value_type& lhs,
+                            const std::pair<Composite, int>& rhs) {
+                           return lhs.first.key() == rhs.first &&
+                                  lhs.second == rhs.second;
+                         }))
+      << "normalized map order";
+  EXPECT_EQ(normalized_map.at(Composite(-1, "ab", 1u)),
+            fl_map.at(Composite(-1, "ab", 1u)))
+      << "normalized map at";
+  EXPECT_EQ(normalized_map.count(Composite(-1, "abc", 1u)), 0u)
+      << "normalized map count";
+}
+
+void FlatMapTest::Hashing() {
+  using FlatSet = tools::flat_set<std::uint32_t>;
+  static_assert(FlatSet::trivially_comparable, "");
+  static_assert(tools::flat_map<int, int>::trivially_comparable, "");
+  static_assert(!tools::flat_map<int, double>::trivially_comparable, "");
+  static_assert(!tools::flat_map<char, int>::trivially_comparable, "padding");
+
+  // sets, that differ in one element at different positions
+  std::vector<std::vector<std::uint32_t>> bodies;
+  for (std::uint32_t size : {0u, 1u, 15u, 16u, 17u, 64u, 100u}) {
+    std::vector<std::uint32_t> body;
+    for (std::uint32_t i = 0; i < size; ++i)
+      body.push_back(i * 3);
+    bodies.push_back(body);
+    for (std::uint32_t pos : {0u, 7u, 16u, 40u, 99u}) {
+      if (pos < size) {
+        auto changed = body;
+        changed[pos] += 1;
+        bodies.push_back(changed);
+      }
+    }
+  }
+  int mismatches = 0;
+  std::unordered_set<std::size_t> hashes;
+  for (const auto& lhs : bodies) {
+    FlatSet lhs_set(lhs.begin(), lhs.end());
+    hashes.insert(std::hash<FlatSet>()(lhs_set));
+    for (const auto& rhs : bodies) {
+      FlatSet rhs_set(rhs.rbegin(), rhs.rend());
+      mismatches += (lhs_set == rhs_set) != (lhs == rhs);
+      mismatches += (lhs_set < rhs_set) != (lhs < rhs);
+      if (lhs == rhs)
+        mismatches += tools::hash_value(lhs_set) != tools::hash_value(rhs_set);
+    }
+  }
+  EXPECT_EQ(mismatches, 0) << "memcmp comparisons";
+  EXPECT_EQ(hashes.size(), bodies.size()) << "hash collisions";
+
+  std::unordered_map<FlatSet, int> features;
+  std::vector<std::uint32_t> feature{5, 1, 3};
+  features[FlatSet(feature.begin(), feature.end())] = 1;
+  features[FlatSet(feature.rbegin(), feature.rend())] += 1;
+  EXPECT_EQ(features.size(), 1u) << "set as a key";
+  EXPECT_EQ(features.begin()->second, 2) << "set as a key";
+
+  using StringMap = tools::flat_map<std::string, double>;
+  StringMap lhs_map;
+  lhs_map.insert({"a", 1.5});
+  lhs_map.insert({"b", -0.0});
+  StringMap rhs_map = lhs_map;
+  rhs_map["b"] = 0.0;
+  EXPECT_TRUE(lhs_map == rhs_map) << "element equality";
+  EXPECT_EQ(std::hash<StringMap>()(lhs_map), std::hash<StringMap>()(rhs_map))
+      << "element hashes";
+  rhs_map["c"] = 1;
+  EXPECT_TRUE(std::hash<StringMap>()(lhs_map) !=
+              std::hash<StringMap>()(rhs_map))
+      << "element hashes";
+
+  using CowMap = tools::cow_flat_map<int, int>;
+  CowMap cow_map;
+  cow_map.insert({1, 2});
+  CowMap cow_copy = cow_map;
+  EXPECT_TRUE(cow_map == cow_copy && !(cow_map < cow_copy))
+      << "shared memcmp body";
+
+  using HashedSet = tools::hashed_flat_set<std::uint32_t>;
+  const char prefix[] = "hashed_flat_set ";
+  HashedSet hashed(feature.begin(), feature.end());
+  HashedSet same(feature.rbegin(), feature.rend());
+  auto hash = hashed.hash();
+  EXPECT_EQ(hash, tools::hash_value(hashed.container())) << prefix;
+  EXPECT_TRUE(hashed == same) << prefix << "==";
+  hashed.insert(7);
+  EXPECT_TRUE(hashed.hash() != hash) << prefix << "insert drops the hash";
+  EXPECT_TRUE(hashed != same) << prefix << "!=";
+  hashed.erase(7);
+  EXPECT_EQ(hashed.hash(), hash) << prefix << "erase drops the hash";
+  {
+    auto guard = hashed.unsafe_access();
+    guard->push_back(0);
+  }
+  EXPECT_EQ(hashed.hash(), tools::hash_value(hashed.container()))
+      << prefix << "unsafe_access drops the hash";
+  {
+    auto guard = hashed.unsafe_access();
+    guard->push_back(20);
+    // caches the hash of a partial body
+    hashed.hash();
+    guard->push_back(-20);
+  }
+  EXPECT_EQ(hashed.hash(), tools::hash_value(hashed.container()))
+      << prefix << "unsafe_access drops the hash at the end";
+  {
+    auto guard = hashed.unsafe_access();
+    guard->pop_back();
+    guard.release();
+  }
+  EXPECT_EQ(hashed.hash(), tools::hash_value(hashed.container()))
+      << prefix << "unsafe_region::release drops the hash";
+  std::unordered_set<HashedSet> hashed_keys{hashed, same, hashed};
+  EXPECT_EQ(hashed_keys.size(), 2u) << prefix << "as a key";
+}
+
 int main() {
   FlatMapTest test;
   test.Getters();
   test.Erasers();
   test.RegularTypeAndConstructors();
   test.Insertions();
+  test.Relocation();
+  test.ThreeWayCompare();
+  test.PrefixedStringKeys();
+  test.TryEmplace();
+  test.Stats();
+  test.Galloping();
+  test.Persistent();
+  test.Filtered();
+  test.Frozen();
+  test.Compressed();
+  test.Parallel();
+  test.Views();
+  test.Streamable();
+  test.StreamableCollection();
+  test.Upsert();
+  test.CopyOnWrite();
+  test.NormalizedKeys();
+  test.Hashing();
 }